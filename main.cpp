@@ -1,30 +1,63 @@
 #ifndef __PROGTEST__
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <deque>
+#include <filesystem>
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <queue>
+#include <random>
 #include <set>
 #include <sstream>
 #include <stack>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <variant>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define HAS_ALLOCATION_COUNTERS
+#endif
+
+// the threaded stages, Progtest gets the sequential ones
+#define HAS_THREADS
+
 using State = unsigned int;
 using Symbol = uint8_t;
 #endif
 
+// the submitted code needs these beyond the headers Progtest provides
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+
 using namespace std;
 using Config = pair<State, Symbol>;
 
@@ -110,26 +143,6 @@ ostream& operator<<(ostream& out, const map<T1, T2>& data) {
 
 #endif
 
-/** Checks if two sets intersect, return true if yes */
-template<typename S>
-bool checkIntersect(const set<S>& s1, const set<S>& s2) {
-    auto first1 = s1.begin();
-    auto first2 = s2.begin();
-    const auto last1 = s1.end();
-    const auto last2 = s2.end();
-
-    while (first1 != last1 && first2 != last2) {
-        if (*first1 < *first2) {
-            ++first1;
-        } else  {
-            if (!(*first2 < *first1))
-                return true;
-            ++first2;
-        }
-    }
-    return false;
-}
-
 template<typename Automat>
 set<Symbol> commonAlphabet(const Automat& aut1, const Automat& aut2) {
     set<Symbol> alphabet;
@@ -141,568 +154,3907 @@ set<Symbol> commonAlphabet(const Automat& aut1, const Automat& aut2) {
     return alphabet;
 }
 
-/** Creates a mapping for FromState -> State */
-template<typename FromConfig, typename FromState>
-map<FromState, State> nameStates(
-        const FromState& initial,
-        const map<FromConfig, FromState>& transitions
-        ) {
-    map<FromState, State> nameMaping;
 
-    // starts at 0
-    State nextStateName = 0;
+// --- Table ------------------------------------------------------------------
 
-    set<FromState> visited = {initial};
-    queue<FromState> queue;
-    queue.push(initial);
+using Column = size_t;
+const State noState = (State) -1;
+const Column noColumn = (Column) -1;
 
-    // BFS
-    while (!queue.empty()) {
-        const State name = nextStateName++;
-        const FromState& state = queue.front();
+/** Maps the symbols of an alphabet to the columns of the transition tables */
+struct Columns {
+    vector<Symbol> m_Alphabet;      // column -> symbol, sorted
+    array<Column, 256> m_Columns;   // symbol -> column, noColumn if not present
 
-        // add to the final result
-        nameMaping.emplace(make_pair(state, name));
+    explicit Columns(const vector<Symbol>& alphabet) : m_Alphabet(alphabet) {
+        m_Columns.fill(noColumn);
+        for (Column column = 0; column < m_Alphabet.size(); ++column)
+            m_Columns[m_Alphabet[column]] = column;
+    }
 
-        // adds other to queue in lexicographical order
-        auto itr = transitions.lower_bound({state, 0});
-        for (; itr != transitions.end() && get<0>(itr -> first) == state; ++itr) {
-            const FromState& targets = itr -> second;
-            if (visited.find(targets) == visited.end()) {
-                visited.emplace(targets);
-                queue.emplace(targets);
-            }
-        }
+    explicit Columns(const set<Symbol>& alphabet)
+        : Columns(vector<Symbol>(alphabet.begin(), alphabet.end())) {}
+
+    size_t width() const { return m_Alphabet.size(); }
+};
 
-        queue.pop();
-    }
-    return nameMaping;
-}
 /**
- * Renames nodes according to the previously generated mapping 
- * and creates the finite notes set. Puts it all into the final DFA */
-DFA commonApplyNaming(
-        const DFA& dfa,
-        const map<Config, State>& transitions,
-        const map<State, State>& nameMaping
-        ) {
+ * Internal DFA representation used by all the stages.
+ * Transitions are stored row by row in a dense states x alphabet array,
+ * missing transitions are marked as noState. */
+struct Table : Columns {
+    using Columns::Columns;
 
-    // states are just integers in [0, n>
-    set<State> newStates = {0}; // the initial state must be always presented
-    for (size_t i = 0; i < nameMaping.size(); ++i)
-        newStates.emplace(i);
+    vector<State> m_Transitions;
+    vector<bool> m_Final;
+    State m_Initial = 0;
 
-    map<Config, State> newTransitions;
+    size_t size() const { return m_Final.size(); }
+    bool isFinal(const State state) const { return m_Final[state]; }
 
-    for (const auto& transition : transitions) {
-        const auto& [setConfig, dest] = transition;
-        const auto [state, symbol] = setConfig;
+    State* row(const State state) {
+        return m_Transitions.data() + (size_t) state * width();
+    }
+    const State* row(const State state) const {
+        return m_Transitions.data() + (size_t) state * width();
+    }
 
-        if (nameMaping.count(state) == 0)
-            continue;
+    /** Appends a new state with no transitions, returns its name */
+    State addState(const bool isFinal) {
+        m_Transitions.resize(m_Transitions.size() + width(), noState);
+        m_Final.push_back(isFinal);
+        return size() - 1;
+    }
+};
 
-        // extract names
-        const State name = nameMaping.at(state);
-        const Config key = Config{name, symbol};
-        const State value = nameMaping.at(dest);
+/**
+ * Converts any DFA into a table over the alphabet given,
+ * it must contain the automat's alphabet. States are renamed to [0, n> */
+Table tableFromDFA(const DFA& dfa, const set<Symbol>& alphabet) {
+    Table table(alphabet);
+
+    map<State, State> index;
+    for (const State state : dfa.m_States) {
+        const State name = table.addState(dfa.m_FinalStates.count(state) != 0);
+        index.emplace(make_pair(state, name));
+    }
 
-        // add to the final result
-        newTransitions.emplace(make_pair(key, value));
+    for (const auto& [config, target] : dfa.m_Transitions) {
+        const auto [state, symbol] = config;
+        table.row(index.at(state))[table.m_Columns[symbol]] = index.at(target);
     }
 
-    set<State> newFinite;
-    for (const State fin : dfa.m_FinalStates)
-        newFinite.emplace(nameMaping.at(fin));
+    table.m_Initial = index.at(dfa.m_InitialState);
+    return table;
+}
 
-    const DFA output = {
-        newStates,
-        dfa.m_Alphabet,
-        newTransitions,
-        0,
-        newFinite
+Table tableFromDFA(const DFA& dfa) {
+    return tableFromDFA(dfa, dfa.m_Alphabet);
+}
+
+/** Converts the internal representation into the final DFA */
+DFA tableToDFA(const Table& table) {
+    set<State> states;
+    map<Config, State> transitions;
+    set<State> finals;
+
+    for (State state = 0; state < table.size(); ++state) {
+        states.emplace_hint(states.end(), state);
+
+        const State* row = table.row(state);
+        for (Column column = 0; column < table.width(); ++column) {
+            if (row[column] != noState) {
+                const Config config = {state, table.m_Alphabet[column]};
+                transitions.emplace_hint(transitions.end(), make_pair(config, row[column]));
+            }
+        }
+
+        if (table.m_Final[state])
+            finals.emplace_hint(finals.end(), state);
+    }
+
+    return DFA {
+        states,
+        set<Symbol>(table.m_Alphabet.begin(), table.m_Alphabet.end()),
+        transitions,
+        table.m_Initial,
+        finals
     };
+}
+
+/**
+ * Renames states in the order they are visited by BFS from the initial state,
+ * symbols are expanded in the lexicographical order. Drops unreachable states. */
+Table tableRename(const Table& table) {
+    const size_t width = table.width();
+
+    vector<State> naming(table.size(), noState);
+    vector<State> order = {table.m_Initial};
+    naming[table.m_Initial] = 0;
+
+    // BFS, order works as the queue
+    for (size_t i = 0; i < order.size(); ++i) {
+        const State* row = table.row(order[i]);
+        for (Column column = 0; column < width; ++column) {
+            const State target = row[column];
+            if (target != noState && naming[target] == noState) {
+                naming[target] = order.size();
+                order.emplace_back(target);
+            }
+        }
+    }
 
-    return output;
+    Table renamed(table.m_Alphabet);
+    for (const State state : order) {
+        const State name = renamed.addState(table.m_Final[state]);
+        const State* row = table.row(state);
+        State* newRow = renamed.row(name);
+
+        for (Column column = 0; column < width; ++column)
+            newRow[column] = row[column] == noState ? noState : naming[row[column]];
+    }
+    return renamed;
 }
 
 DFA commonNaming(const DFA& dfa) {
-    const map<State, State> nameMaping = nameStates(dfa.m_InitialState, dfa.m_Transitions);
-    return commonApplyNaming(dfa, dfa.m_Transitions, nameMaping);
+    return tableToDFA(tableRename(tableFromDFA(dfa)));
 }
 
+/**
+ * Internal NFA representation, states are renamed to [0, n>.
+ * Targets of all the (state, column) pairs are stored sorted in one array,
+ * m_Offsets[state * width + column] points to the first of them. */
+struct NFATable : Columns {
+    using Columns::Columns;
+
+    vector<size_t> m_Offsets;
+    vector<State> m_Targets;
+    vector<bool> m_Final;
+    State m_Initial = 0;
+
+    size_t size() const { return m_Final.size(); }
+    bool isFinal(const State state) const { return m_Final[state]; }
+
+    const State* targetsBegin(const State state, const Column column) const {
+        return m_Targets.data() + m_Offsets[(size_t) state * width() + column];
+    }
+    const State* targetsEnd(const State state, const Column column) const {
+        return m_Targets.data() + m_Offsets[(size_t) state * width() + column + 1];
+    }
+};
+
+/** Converts a NFA into a table over the alphabet given, it must contain the automat's alphabet */
+NFATable nfaCompile(const NFA& nfa, const set<Symbol>& alphabet) {
+    NFATable table(alphabet);
+    const size_t width = table.width();
 
-// --- Minimization -----------------------------------------------------------
+    const vector<State> names(nfa.m_States.begin(), nfa.m_States.end());
+    const auto index = [&](const State state) -> State {
+        return lower_bound(names.begin(), names.end(), state) - names.begin();
+    };
 
-DFA minimizeRemoveUseless(const DFA& dfa) {
-    const map<Config, State>& trans = dfa.m_Transitions;
+    table.m_Offsets.assign(names.size() * width + 1, 0);
+    for (const auto& [config, targets] : nfa.m_Transitions) {
+        const size_t key = (size_t) index(config.first) * width + table.m_Columns[config.second];
+        table.m_Offsets[key + 1] = targets.size();
+    }
+    partial_sum(table.m_Offsets.begin(), table.m_Offsets.end(), table.m_Offsets.begin());
+
+    // renaming keeps the order, so the targets stay sorted
+    table.m_Targets.resize(table.m_Offsets.back());
+    for (const auto& [config, targets] : nfa.m_Transitions) {
+        const size_t key = (size_t) index(config.first) * width + table.m_Columns[config.second];
+        State* output = table.m_Targets.data() + table.m_Offsets[key];
+        for (const State target : targets)
+            *output++ = index(target);
+    }
 
-    map<State, set<State>> tracking;
-    {
-        queue<State> queue;
-        queue.push(dfa.m_InitialState);
-        set<State> visited;
+    for (const State state : names)
+        table.m_Final.push_back(nfa.m_FinalStates.count(state) != 0);
 
-        while(!queue.empty()) {
-            const State state = queue.front();
-            queue.pop();
+    table.m_Initial = index(nfa.m_InitialState);
+    return table;
+}
 
-            auto itr = trans.lower_bound({state, 0});
+/** Converts a table into a (deterministic) NFA table */
+NFATable nfaFromTable(const Table& table) {
+    NFATable result(table.m_Alphabet);
 
-            for (; itr != trans.end() && get<0>(itr -> first) == state; ++itr) {
-                const State target = itr -> second;
-                tracking[target].emplace(state);
+    result.m_Offsets.reserve(table.m_Transitions.size() + 1);
+    result.m_Offsets.emplace_back(0);
+    for (const State target : table.m_Transitions) {
+        if (target != noState)
+            result.m_Targets.emplace_back(target);
+        result.m_Offsets.emplace_back(result.m_Targets.size());
+    }
 
-                if (visited.count(target) == 0) {
-                    visited.emplace(target);
-                    queue.push(target);
-                }
+    result.m_Final = table.m_Final;
+    result.m_Initial = table.m_Initial;
+    return result;
+}
+
+/**
+ * Removes the states that are not reachable from the initial state
+ * or that cannot reach any final state, the initial state is always kept.
+ * States keep their relative order. */
+NFATable nfaTrim(const NFATable& nfa) {
+    const size_t width = nfa.width();
+    const size_t size = nfa.size();
+
+    // forward reachability
+    vector<bool> reachable(size, false);
+    vector<State> order = {nfa.m_Initial};
+    reachable[nfa.m_Initial] = true;
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        // all the columns of a state are stored back to back
+        const size_t state = order[i];
+        for (size_t j = nfa.m_Offsets[state * width]; j < nfa.m_Offsets[(state + 1) * width]; ++j) {
+            const State target = nfa.m_Targets[j];
+            if (!reachable[target]) {
+                reachable[target] = true;
+                order.emplace_back(target);
             }
         }
     }
-    set<State> useful = dfa.m_FinalStates;
+
+    // reversed edges of the reachable part, the columns are not needed
+    vector<size_t> offsets(size + 1, 0);
+    for (const size_t state : order)
+        for (size_t i = nfa.m_Offsets[state * width]; i < nfa.m_Offsets[(state + 1) * width]; ++i)
+            ++offsets[nfa.m_Targets[i] + 1];
+    partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    vector<State> parents(offsets.back());
     {
-        queue<State> queue;
-        for (const State fin : dfa.m_FinalStates)
-            queue.push(fin);
-
-        while(!queue.empty()) {
-            const State state = queue.front();
-            queue.pop();
-
-            for (const State parent : tracking[state]) {
-                if (useful.count(parent) == 0) {
-                    useful.emplace(parent);
-                    queue.push(parent);
-                }
+        vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (const State state : order)
+            for (size_t i = nfa.m_Offsets[(size_t) state * width]; i < nfa.m_Offsets[((size_t) state + 1) * width]; ++i)
+                parents[fill[nfa.m_Targets[i]]++] = state;
+    }
+
+    // backward reachability from the final states
+    vector<bool> useful(size, false);
+    vector<State> stack;
+    for (const State state : order) {
+        if (nfa.m_Final[state]) {
+            useful[state] = true;
+            stack.emplace_back(state);
+        }
+    }
+
+    while (!stack.empty()) {
+        const State state = stack.back();
+        stack.pop_back();
+
+        for (size_t i = offsets[state]; i < offsets[state + 1]; ++i) {
+            const State parent = parents[i];
+            if (!useful[parent]) {
+                useful[parent] = true;
+                stack.emplace_back(parent);
             }
         }
     }
 
-    map<Config, State> newTransitions;
-    for (const auto& [config, target] : dfa.m_Transitions) {
-        if (useful.count(config.first) != 0 && useful.count(target) != 0 )
-            newTransitions.emplace(make_pair(config, target));
+    vector<State> naming(size, noState);
+    NFATable result(nfa.m_Alphabet);
+    for (State state = 0; state < size; ++state) {
+        if (useful[state] || state == nfa.m_Initial) {
+            naming[state] = result.m_Final.size();
+            result.m_Final.push_back(nfa.m_Final[state] && useful[state]);
+        }
+    }
+
+    result.m_Offsets.reserve(result.size() * width + 1);
+    result.m_Offsets.emplace_back(0);
+    for (State state = 0; state < size; ++state) {
+        if (naming[state] == noState) continue;
+
+        for (Column column = 0; column < width; ++column) {
+            // a dead initial state keeps no transitions
+            if (useful[state])
+                for (const State* target = nfa.targetsBegin(state, column); target != nfa.targetsEnd(state, column); ++target)
+                    if (useful[*target])
+                        result.m_Targets.emplace_back(naming[*target]);
+            result.m_Offsets.emplace_back(result.m_Targets.size());
+        }
     }
 
-    useful.emplace(dfa.m_InitialState);
+    result.m_Initial = naming[nfa.m_Initial];
+    return result;
+}
 
-    return DFA {
-        useful, dfa.m_Alphabet, newTransitions, dfa.m_InitialState, dfa.m_FinalStates
+/** Converts a DFA into a NFA accepting the same language */
+NFA dfaToNFA(const DFA& dfa) {
+    map<Config, set<State>> transitions;
+    for (const auto& [config, target] : dfa.m_Transitions)
+        transitions.emplace_hint(transitions.end(), make_pair(config, set<State>{target}));
+
+    return NFA {
+        dfa.m_States, dfa.m_Alphabet, transitions, dfa.m_InitialState, dfa.m_FinalStates
     };
 }
 
-using Group = State;
-using CheckingResult = tuple<Group, vector<Group>, State>;
-const State emptyGroup = (State) -1;
-
-map<State, Group> minimizeCreateInitialLookup(const DFA& dfa) {
-    const set<State>& states = dfa.m_States;
-    const set<State>& fin = dfa.m_FinalStates;
 
-    map<State, Group> lookup;
+// --- Alphabet compression ---------------------------------------------------
 
-    for (const State state : states) {
-        const Group group = fin.count(state) != 0;
-        lookup.emplace(make_pair(state, group));
+uint64_t subsetHash(const State* begin, const State* end) {
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ (uint64_t) (end - begin);
+    for (; begin != end; ++begin) {
+        hash = (hash ^ *begin) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
     }
+    return hash;
+}
 
-    return lookup;
+/** Symbols behaving the same in all the automates are merged into one class */
+struct SymbolClasses {
+    vector<Column> m_ClassOf;           // column -> class
+    vector<Symbol> m_Representatives;   // class -> its smallest symbol
+};
+
+/** Checks if both the columns have the same targets in all the states of all the tables */
+bool symbolColumnsEqual(const vector<const NFATable*>& tables, const Column column1, const Column column2) {
+    for (const NFATable* table : tables)
+        for (State state = 0; state < table -> size(); ++state)
+            if (!equal(table -> targetsBegin(state, column1), table -> targetsEnd(state, column1),
+                        table -> targetsBegin(state, column2), table -> targetsEnd(state, column2)))
+                return false;
+    return true;
 }
 
-map<State, Group> minimizeCreateDerivedLookup(const DFA& dfa, const set<CheckingResult>& prev) {
-    map<State, Group> lookup;
-    Group nameCounter = 0;
+/** All the tables must share the same alphabet */
+SymbolClasses symbolClasses(const vector<const NFATable*>& tables, const vector<Symbol>& alphabet) {
+    const size_t width = alphabet.size();
+
+    // columns with different hashes cannot be equal
+    vector<uint64_t> hashes(width, 0);
+    for (const NFATable* table : tables) {
+        for (State state = 0; state < table -> size(); ++state) {
+            for (Column column = 0; column < width; ++column) {
+                const State* begin = table -> targetsBegin(state, column);
+                const State* end = table -> targetsEnd(state, column);
+                if (begin != end)
+                    hashes[column] = (hashes[column] ^ subsetHash(begin, end)) * 0x100000001b3ull + state;
+            }
+        }
+    }
+
+    SymbolClasses classes;
+    classes.m_ClassOf.resize(width);
+    vector<Column> representatives;
+    unordered_map<uint64_t, vector<Column>> candidates;
 
-    if (prev.empty()) return lookup;
-    // insert the first row
-    lookup.emplace(make_pair(get<2>(*prev.begin()), nameCounter));
+    for (Column column = 0; column < width; ++column) {
+        vector<Column>& sameHash = candidates[hashes[column]];
+        const auto found = find_if(sameHash.begin(), sameHash.end(), [&](const Column group) {
+            return symbolColumnsEqual(tables, representatives[group], column);
+        });
 
-    for (auto itr = ++prev.begin(), itrPrev = prev.begin(); itr != prev.end(); ++itr, ++itrPrev) {
-        const State state = get<2>(*itr);
-        if (get<0>(*itr) == get<0>(*itrPrev) &&
-                get<1>(*itr) == get<1>(*itrPrev)) {
-            lookup.emplace(make_pair(state, nameCounter));
+        if (found != sameHash.end()) {
+            classes.m_ClassOf[column] = *found;
         } else {
-            lookup.emplace(make_pair(state, ++nameCounter));
+            classes.m_ClassOf[column] = representatives.size();
+            sameHash.emplace_back(representatives.size());
+            representatives.emplace_back(column);
+            classes.m_Representatives.emplace_back(alphabet[column]);
+        }
+    }
+    return classes;
+}
+
+/** Creates a table with a column per class, the representative's targets are used */
+NFATable compressColumns(const NFATable& table, const SymbolClasses& classes) {
+    NFATable result(classes.m_Representatives);
+
+    result.m_Offsets.reserve(table.size() * result.width() + 1);
+    result.m_Offsets.emplace_back(0);
+    for (State state = 0; state < table.size(); ++state) {
+        for (const Symbol symbol : classes.m_Representatives) {
+            const Column column = table.m_Columns[symbol];
+            result.m_Targets.insert(result.m_Targets.end(),
+                    table.targetsBegin(state, column), table.targetsEnd(state, column));
+            result.m_Offsets.emplace_back(result.m_Targets.size());
         }
     }
 
-    return lookup;
+    result.m_Final = table.m_Final;
+    result.m_Initial = table.m_Initial;
+    return result;
 }
 
-set<CheckingResult> minimizeFillInTrans(const DFA& dfa, const map<State, Group>& lookup) {
-    const set<Symbol>& alphabet = dfa.m_Alphabet;
-    const set<State>& states = dfa.m_States;
-    const map<Config, State>& trans = dfa.m_Transitions;
+/** Expands a table over the classes back to the whole alphabet */
+Table expandColumns(const Table& table, const vector<Symbol>& alphabet, const SymbolClasses& classes) {
+    Table result(alphabet);
+    const size_t width = result.width();
 
-    set<CheckingResult> result;
+    for (State state = 0; state < table.size(); ++state) {
+        result.addState(table.isFinal(state));
+        const State* row = table.row(state);
+        State* newRow = result.row(state);
 
-    for (const State state : states) {
-        const Group group = lookup.at(state);
-        vector<Group> mappedTrans;
-        mappedTrans.reserve(alphabet.size());
+        for (Column column = 0; column < width; ++column)
+            newRow[column] = row[classes.m_ClassOf[column]];
+    }
 
-        for (const Symbol symbol : alphabet) {
-            const Config key = {state, symbol};
-            const auto res = trans.find(key);
+    result.m_Initial = table.m_Initial;
+    return result;
+}
 
-            if (res != trans.end() && states.count(res -> second) != 0) {
-                mappedTrans.emplace_back(lookup.at(res -> second));
-            } else {
-                mappedTrans.emplace_back(emptyGroup);
-            }
-        }
 
-        result.emplace(CheckingResult{group, mappedTrans, state});
+// --- Options ----------------------------------------------------------------
+
+enum class Minimizer { Moore, Hopcroft, Brzozowski };
+enum class Successors { Lists, Bitsets };
+enum class Pipeline { Auto, Subsets, Brzozowski };
+enum class Reduction { None, Bisimulation, Simulation };
+
+/** Selects the algorithms used by the pipeline, defaults are used by unify/intersect */
+struct Options {
+    Minimizer m_Minimizer = Minimizer::Hopcroft;
+    Successors m_Successors = Successors::Lists;    // subset construction merging
+    bool m_Lazy = true;     // determinize the operands only as far as the product reaches
+    bool m_MinimizeOperands = false;    // n-ary operations minimize each operand first
+    bool m_CompressAlphabet = true;     // run over the classes of symbols behaving the same
+    bool m_Trim = true;     // drop the unreachable and dead NFA states before determinization
+    size_t m_Threads = 1;   // workers of the materialized determinization, product and Moore's refinement
+    Pipeline m_Pipeline = Pipeline::Subsets;    // binary operations, Auto lets selectPipeline sample the operands first
+    Reduction m_Reduction = Reduction::None;    // merge the equivalent NFA states first
+    struct OperandCache* m_Cache = nullptr;     // determinized operands are reused if not nullptr
+    struct Statistics* m_Statistics = nullptr;  // filled in if not nullptr
+};
+
+
+// --- Statistics -------------------------------------------------------------
+
+#ifdef HAS_ALLOCATION_COUNTERS
+/**
+ * Heap usage of the thread, counted only while it records a stage.
+ * The sizes are the ones malloc reports, so the blocks need no header
+ * and the ones allocated before the stage may be freed within it.
+ * Live and peak are signed for the same reason, only their differences
+ * make sense. */
+struct AllocationCounters {
+    size_t m_Depth;     // stages being recorded
+    size_t m_Total;
+    ptrdiff_t m_Live;
+    ptrdiff_t m_Peak;
+};
+
+thread_local AllocationCounters allocationCounters = {0, 0, 0, 0};
+
+// kept out of line, so the compiler does not pair the malloc inside with the callers' frees
+__attribute__((noinline))
+void* operator new(const size_t size) {
+    void* block = malloc(size == 0 ? 1 : size);
+    if (block == nullptr) throw bad_alloc();
+
+    AllocationCounters& counters = allocationCounters;
+    if (counters.m_Depth != 0) {
+        const size_t usable = malloc_usable_size(block);
+        counters.m_Total += usable;
+        counters.m_Live += usable;
+        counters.m_Peak = max(counters.m_Peak, counters.m_Live);
     }
+    return block;
+}
+
+__attribute__((noinline))
+void operator delete(void* pointer) noexcept {
+    AllocationCounters& counters = allocationCounters;
+    if (pointer != nullptr && counters.m_Depth != 0)
+        counters.m_Live -= malloc_usable_size(pointer);
+    free(pointer);
+}
+
+void* operator new[](const size_t size) { return operator new(size); }
+void operator delete[](void* pointer) noexcept { operator delete(pointer); }
+void operator delete(void* pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { operator delete(pointer); }
+
+// the nothrow forms must use malloc too, sanitizers report a mismatch otherwise
+void* operator new(const size_t size, const nothrow_t&) noexcept {
+    try { return operator new(size); } catch (const bad_alloc&) { return nullptr; }
+}
+void* operator new[](const size_t size, const nothrow_t&) noexcept { return operator new(size, nothrow); }
+void operator delete(void* pointer, const nothrow_t&) noexcept { operator delete(pointer); }
+void operator delete[](void* pointer, const nothrow_t&) noexcept { operator delete(pointer); }
+#endif
+
+struct StageStatistics {
+    string m_Name;
+    double m_Seconds = 0;
+    size_t m_States = 0;            // after the stage
+    size_t m_Transitions = 0;
+    size_t m_Rounds = 0;            // refinement rounds or processed splitters
+    size_t m_MaxQueue = 0;          // max BFS queue length
+    size_t m_AllocatedBytes = 0;    // by the recording thread, 0 without HAS_ALLOCATION_COUNTERS
+    size_t m_PeakBytes = 0;         // peak heap usage above the one at the start
+};
+
+/** What selectPipeline measured and chose, the measures are 0 if it was not needed */
+struct SelectorDecision {
+    Pipeline m_Pipeline = Pipeline::Subsets;
+    bool m_Forced = false;
+    double m_Nondeterminism = 0;        // average targets of a non-empty transition
+    double m_ReverseNondeterminism = 0;
+    size_t m_SampleLimit = 0;           // subsets the samples may reach in total
+    size_t m_ForwardSubsets = 0;
+    size_t m_ReverseSubsets = 0;
+};
+
+/** Filled in by the pipeline if Options::m_Statistics points to it */
+struct Statistics {
+    vector<StageStatistics> m_Stages;
+    vector<SelectorDecision> m_Decisions;
+};
+
+size_t countTransitions(const Table& table) {
+    return count_if(table.m_Transitions.begin(), table.m_Transitions.end(),
+            [](const State target) { return target != noState; });
+}
+
+size_t countTransitions(const NFATable& table) {
+    return table.m_Targets.size();
+}
+
+#ifndef __PROGTEST__
+/**
+ * Runs the stage, run gets the stage statistics to fill in or nullptr.
+ * Records the time, the output size and the allocations if statistics are requested. */
+template<typename Run>
+auto statisticsStage(Statistics* statistics, const char* name, const Run& run) -> decltype(run(nullptr)) {
+    if (statistics == nullptr)
+        return run(nullptr);
+
+    StageStatistics stage;
+    stage.m_Name = name;
+
+#ifdef HAS_ALLOCATION_COUNTERS
+    AllocationCounters& counters = allocationCounters;
+    const size_t total = counters.m_Total;
+    const ptrdiff_t live = counters.m_Live;
+    const ptrdiff_t outerPeak = counters.m_Peak;
+    counters.m_Peak = live;
+    ++counters.m_Depth;
+#endif
+    const auto start = chrono::steady_clock::now();
+
+    auto result = run(&stage);
+
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+#ifdef HAS_ALLOCATION_COUNTERS
+    --counters.m_Depth;
+    stage.m_AllocatedBytes = counters.m_Total - total;
+    stage.m_PeakBytes = counters.m_Peak - live;
+    // an enclosing stage keeps its own peak
+    counters.m_Peak = max(outerPeak, counters.m_Peak);
+#endif
+    stage.m_Seconds = elapsed.count();
+    stage.m_States = result.size();
+    stage.m_Transitions = countTransitions(result);
+
+    statistics -> m_Stages.emplace_back(move(stage));
     return result;
 }
+#else
+/** Progtest has neither the clock nor the counters, the stages are just run */
+template<typename Run>
+auto statisticsStage(Statistics*, const char*, const Run& run) -> decltype(run(nullptr)) {
+    return run(nullptr);
+}
+#endif
 
-DFA minimizeToAutomate(const DFA& dfa, const set<CheckingResult>& current) {
-    const set<Symbol>& alphabet = dfa.m_Alphabet;
-    const set<State>& fin = dfa.m_FinalStates;
+/** Records the size of a table built within another stage, it has no time or allocations of its own */
+void statisticsSize(Statistics* statistics, const char* name, const Table& table) {
+    if (statistics == nullptr) return;
 
-    set<State> newStates;
-    map<Config, State> newTrans;
-    set<State> newFin;
-    State newInitial = (State) -1;
+    StageStatistics stage;
+    stage.m_Name = name;
+    stage.m_States = table.size();
+    stage.m_Transitions = countTransitions(table);
+    statistics -> m_Stages.emplace_back(move(stage));
+}
 
-    for (const auto& res : current) {
-        const auto& [group, children, state] = res;
-        newStates.emplace(group);
+/** Records the size of a state queue, works with nullptr stage */
+void statisticsQueue(StageStatistics* stage, const size_t length) {
+    if (stage != nullptr && length > stage -> m_MaxQueue)
+        stage -> m_MaxQueue = length;
+}
 
-        auto alpItr = alphabet.begin();
-        auto chItr = children.begin();
 
-        for (; alpItr != alphabet.end(); ++alpItr, ++chItr) {
-            const Group& child = *chItr;
-            if (child != emptyGroup)
-                newTrans.emplace(make_pair(Config{group, *alpItr}, child));
-        }
+// --- Threads ----------------------------------------------------------------
 
-        if (fin.count(state) != 0)
-            newFin.emplace(group);
-        if (dfa.m_InitialState == state)
-            newInitial = group;
+#ifdef HAS_THREADS
+/**
+ * Runs body(worker, begin, end) over [0, count> split into chunks,
+ * the workers take the chunks as they finish the previous ones.
+ * Small inputs are run by the calling thread only. */
+template<typename Body>
+void parallelChunks(const size_t threads, const size_t count, const size_t chunk, const Body& body) {
+    if (threads <= 1 || count <= chunk) {
+        body(0, 0, count);
+        return;
     }
 
-    return DFA {
-        newStates, dfa.m_Alphabet, newTrans, newInitial, newFin
+    atomic<size_t> next(0);
+    const auto work = [&](const size_t id) {
+        while (true) {
+            const size_t begin = next.fetch_add(chunk);
+            if (begin >= count) return;
+            body(id, begin, min(begin + chunk, count));
+        }
     };
+
+    vector<thread> workers;
+    for (size_t id = 1; id < threads; ++id)
+        workers.emplace_back(work, id);
+    work(0);
+    for (thread& worker : workers)
+        worker.join();
 }
+#else
+/** Without threads the calling thread runs all the chunks at once */
+template<typename Body>
+void parallelChunks(size_t, const size_t count, size_t, const Body& body) {
+    body(0, 0, count);
+}
+#endif
+
+
+// --- Minimization -----------------------------------------------------------
+
+Table minimizeRemoveUseless(const Table& table) {
+    const size_t width = table.width();
+    const size_t size = table.size();
+
+    // forward reachability
+    vector<bool> reachable(size, false);
+    vector<State> order = {table.m_Initial};
+    reachable[table.m_Initial] = true;
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        const State* row = table.row(order[i]);
+        for (Column column = 0; column < width; ++column) {
+            const State target = row[column];
+            if (target != noState && !reachable[target]) {
+                reachable[target] = true;
+                order.emplace_back(target);
+            }
+        }
+    }
 
-DFA minimizeEquiv(const DFA& dfa) {
+    // reversed edges of the reachable part, stored as offsets into one array
+    vector<size_t> offsets(size + 1, 0);
+    for (const State state : order) {
+        const State* row = table.row(state);
+        for (Column column = 0; column < width; ++column)
+            if (row[column] != noState)
+                ++offsets[row[column] + 1];
+    }
+    partial_sum(offsets.begin(), offsets.end(), offsets.begin());
 
-    set<CheckingResult> prevState;
-    set<CheckingResult> currentState;
+    vector<State> parents(offsets.back());
     {
-        const map<State, Group> lookup = minimizeCreateInitialLookup(dfa);
-        prevState = minimizeFillInTrans(dfa, lookup);
+        vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (const State state : order) {
+            const State* row = table.row(state);
+            for (Column column = 0; column < width; ++column)
+                if (row[column] != noState)
+                    parents[fill[row[column]]++] = state;
+        }
+    }
+
+    // backward reachability from the final states
+    vector<bool> useful(size, false);
+    vector<State> stack;
+    for (const State state : order) {
+        if (table.m_Final[state]) {
+            useful[state] = true;
+            stack.emplace_back(state);
+        }
+    }
+
+    while (!stack.empty()) {
+        const State state = stack.back();
+        stack.pop_back();
+
+        for (size_t i = offsets[state]; i < offsets[state + 1]; ++i) {
+            const State parent = parents[i];
+            if (!useful[parent]) {
+                useful[parent] = true;
+                stack.emplace_back(parent);
+            }
+        }
     }
 
+    // the initial state must be always presented
+    vector<State> naming(size, noState);
+    Table result(table.m_Alphabet);
+    for (State state = 0; state < size; ++state)
+        if (useful[state] || state == table.m_Initial)
+            naming[state] = result.addState(table.m_Final[state] && useful[state]);
+
+    for (State state = 0; state < size; ++state) {
+        if (!useful[state]) continue;
 
-    while(true) {
-        const map<State, Group> lookup = minimizeCreateDerivedLookup(dfa, prevState);
-        currentState = minimizeFillInTrans(dfa, lookup);
+        const State* row = table.row(state);
+        State* newRow = result.row(naming[state]);
 
-        if (currentState == prevState) break;
-        swap(currentState, prevState);
+        for (Column column = 0; column < width; ++column) {
+            const State target = row[column];
+            if (target != noState && useful[target])
+                newRow[column] = naming[target];
+        }
     }
 
-    return minimizeToAutomate(dfa, currentState);
+    result.m_Initial = naming[table.m_Initial];
+    return result;
 }
 
-DFA minimize(const DFA& dfa) {
-    // removeUnreachable - removed by prev algorithms
-    const DFA& ready = minimizeRemoveUseless(dfa);
-    return minimizeEquiv(ready);
+using Group = State;
+const Group emptyGroup = noState;
+
+/** The radix sort splits the items among the threads only if each gets at least this many */
+const size_t radixSortBlock = 4096;
+
+/** Sorts the items by their keys, stable, a byte per pass from the lowest one */
+void minimizeRadixSort(vector<pair<uint64_t, State>>& items, const size_t threads) {
+    // a single block keeps all the passes on the calling thread
+    const size_t workers = max<size_t>(threads, 1);
+    const size_t blocks = items.size() < workers * radixSortBlock ? 1 : workers;
+    const size_t perBlock = (items.size() + blocks - 1) / blocks;
+    const auto blockBegin = [&](const size_t block) { return min(items.size(), block * perBlock); };
+
+    vector<pair<uint64_t, State>> buffer(items.size());
+    vector<array<size_t, 256>> counts(blocks);
+
+    for (size_t shift = 0; shift < 64; shift += 8) {
+        parallelChunks(threads, blocks, 1, [&](size_t, const size_t first, const size_t last) {
+            for (size_t block = first; block < last; ++block) {
+                counts[block].fill(0);
+                for (size_t i = blockBegin(block); i < blockBegin(block + 1); ++i)
+                    ++counts[block][(items[i].first >> shift) & 0xff];
+            }
+        });
+
+        // digit major offsets keep the equal digits in the block order
+        size_t offset = 0;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            for (size_t block = 0; block < blocks; ++block) {
+                const size_t count = counts[block][digit];
+                counts[block][digit] = offset;
+                offset += count;
+            }
+        }
+
+        parallelChunks(threads, blocks, 1, [&](size_t, const size_t first, const size_t last) {
+            for (size_t block = first; block < last; ++block)
+                for (size_t i = blockBegin(block); i < blockBegin(block + 1); ++i)
+                    buffer[counts[block][(items[i].first >> shift) & 0xff]++] = items[i];
+        });
+        items.swap(buffer);
+    }
 }
 
+/**
+ * Moore's partition refinement. Each round every state gets the signature
+ * of its group and the groups of its children, computed in parallel into
+ * a flat buffer. The states are radix sorted by the signature hashes,
+ * the runs of identical signatures become the new groups.
+ * Stops once a round creates no new group. */
+Table minimizeEquiv(const Table& table, StageStatistics* stage = nullptr, const size_t threads = 1) {
+    const size_t width = table.width();
+    const size_t size = table.size();
+    const size_t stride = width + 1;
+    const size_t chunk = 1024;
+
+    vector<Group> groups(size);
+    for (State state = 0; state < size; ++state)
+        groups[state] = table.m_Final[state];
+    size_t count = (find(table.m_Final.begin(), table.m_Final.end(), true) != table.m_Final.end())
+            + (find(table.m_Final.begin(), table.m_Final.end(), false) != table.m_Final.end());
+
+    vector<Group> signatures(size * stride);
+    vector<pair<uint64_t, State>> order(size);
+    vector<Group> next(size);
+
+    const auto signature = [&](const State state) { return signatures.data() + state * stride; };
+    const auto same = [&](const State first, const State second) {
+        return equal(signature(first), signature(first) + stride, signature(second));
+    };
 
-// --- Parallel run -----------------------------------------------------------
+    while (true) {
+        if (stage != nullptr) ++stage -> m_Rounds;
+
+        parallelChunks(threads, size, chunk, [&](size_t, const size_t begin, const size_t end) {
+            for (State state = begin; state < end; ++state) {
+                Group* result = signature(state);
+                const State* row = table.row(state);
+
+                result[0] = groups[state];
+                for (Column column = 0; column < width; ++column)
+                    result[column + 1] = row[column] == noState ? emptyGroup : groups[row[column]];
+                order[state] = {subsetHash(result, result + stride), state};
+            }
+        });
+        minimizeRadixSort(order, threads);
+
+        // single pass over the runs of equal hashes, colliding runs are sorted by the signatures
+        Group created = 0;
+        for (size_t begin = 0, end; begin < size; begin = end, ++created) {
+            bool collision = false;
+            for (end = begin + 1; end < size && order[end].first == order[begin].first; ++end)
+                collision = collision || !same(order[end].second, order[begin].second);
+
+            if (collision) {
+                sort(order.begin() + begin, order.begin() + end, [&](const auto& first, const auto& second) {
+                    return lexicographical_compare(signature(first.second), signature(first.second) + stride,
+                            signature(second.second), signature(second.second) + stride);
+                });
+            }
+
+            for (size_t i = begin; i < end; ++i) {
+                if (i != begin && !same(order[i].second, order[i - 1].second))
+                    ++created;
+                next[order[i].second] = created;
+            }
+        }
+
+        groups.swap(next);
+        if (created == count) break;
+        count = created;
+    }
+
+    // groups are named [0, n>
+    Table result(table.m_Alphabet);
+    for (Group group = 0; group < count; ++group)
+        result.addState(false);
+
+    for (State state = 0; state < size; ++state) {
+        const Group group = groups[state];
+        const State* source = table.row(state);
+        State* row = result.row(group);
+
+        for (Column column = 0; column < width; ++column)
+            row[column] = source[column] == noState ? emptyGroup : groups[source[column]];
+        if (table.m_Final[state])
+            result.m_Final[group] = true;
+    }
+
+    result.m_Initial = groups[table.m_Initial];
+    return result;
+}
 
-using DoubleState = tuple<State, State>;
-using DoubleConfig = tuple<DoubleState, Symbol>;
+/**
+ * Hopcroft's partition refinement run directly on the partial table, missing
+ * transitions are not materialized (Valmari & Lehtinen). All the states are
+ * expected to be useful (see minimizeRemoveUseless), only the initial one
+ * may be dead. Blocks are kept as continuous ranges in the elements array,
+ * a split always creates a new block from the smaller half, so the new block
+ * is the only one that has to be added into the worklist. The initial blocks
+ * are all in the worklist, that is what makes the trick valid without a sink. */
+Table minimizeHopcroft(const Table& table, StageStatistics* stage = nullptr) {
+    const size_t width = table.width();
+    const size_t size = table.size();
+
+    // inverse transitions, indexed by column * size + target
+    vector<size_t> offsets(width * size + 1, 0);
+    for (State state = 0; state < size; ++state) {
+        const State* row = table.row(state);
+        for (Column column = 0; column < width; ++column)
+            if (row[column] != noState)
+                ++offsets[column * size + row[column] + 1];
+    }
+    partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    vector<State> parents(offsets.back());
+    {
+        vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (State state = 0; state < size; ++state) {
+            const State* row = table.row(state);
+            for (Column column = 0; column < width; ++column)
+                if (row[column] != noState)
+                    parents[fill[column * size + row[column]]++] = state;
+        }
+    }
 
-map<DoubleConfig, DoubleState> parallelRunTransitions(const DFA& dfa1, const DFA& dfa2) {
-    const map<Config, State>& trans1 = dfa1.m_Transitions;
-    const map<Config, State>& trans2 = dfa2.m_Transitions;
-    const set<Symbol> alphabet = dfa1.m_Alphabet;
+    // initial partition, final states first
+    vector<State> elements(size);
+    iota(elements.begin(), elements.end(), 0);
+    const auto firstNonFinal = stable_partition(elements.begin(), elements.end(),
+            [&](const State state) { return table.m_Final[state]; });
+    const size_t finals = firstNonFinal - elements.begin();
 
-    map<DoubleConfig, DoubleState> transitions;
+    vector<size_t> location(size);
+    for (size_t i = 0; i < size; ++i)
+        location[elements[i]] = i;
 
-    queue<DoubleState> queue;
-    queue.push({dfa1.m_InitialState, dfa2.m_InitialState});
-    set<DoubleState> visited = {{dfa1.m_InitialState, dfa2.m_InitialState}};
+    vector<Group> blockOf(size, 0);
+    vector<size_t> blockStart, blockEnd, marked;
+    vector<Group> worklist;
 
-    while(!queue.empty()) {
-        const auto& state = queue.front();
-        const auto [state1, state2] = state;
+    if (finals != 0) {
+        blockStart.emplace_back(0);
+        blockEnd.emplace_back(finals);
+    }
+    if (finals != size) {
+        blockStart.emplace_back(finals);
+        blockEnd.emplace_back(size);
+    }
+    marked.resize(blockStart.size(), 0);
 
-        auto itr1 = trans1.lower_bound({state1, 0});
-        auto itr2 = trans2.lower_bound({state2, 0});
-        // requires same alphabet and full automates
-        for (const Symbol symbol : alphabet) {
-            // next state
-            const DoubleState target = {itr1 -> second, itr2 -> second};
+    for (Group group = 0; group < blockStart.size(); ++group) {
+        for (size_t i = blockStart[group]; i < blockEnd[group]; ++i)
+            blockOf[elements[i]] = group;
+        worklist.emplace_back(group);
+    }
 
-            if (visited.find(target) == visited.end()) {
-                visited.emplace(target);
-                queue.push(target);
+    vector<State> splitter;
+    vector<Group> touched;
+
+    while (!worklist.empty()) {
+        const Group current = worklist.back();
+        worklist.pop_back();
+        if (stage != nullptr) ++stage -> m_Rounds;
+
+        // the block may be split while processing, the original one is used
+        splitter.assign(elements.begin() + blockStart[current], elements.begin() + blockEnd[current]);
+
+        for (Column column = 0; column < width; ++column) {
+            // move the predecessors to the front of their blocks
+            for (const State state : splitter) {
+                const size_t key = column * size + state;
+                for (size_t i = offsets[key]; i < offsets[key + 1]; ++i) {
+                    const State parent = parents[i];
+                    const Group group = blockOf[parent];
+                    const size_t position = location[parent];
+                    const size_t border = blockStart[group] + marked[group];
+
+                    if (position < border) continue;
+                    if (marked[group] == 0)
+                        touched.emplace_back(group);
+
+                    swap(elements[position], elements[border]);
+                    location[elements[position]] = position;
+                    location[elements[border]] = border;
+                    ++marked[group];
+                }
             }
 
-            const DoubleConfig current = {state, symbol};
-            transitions.emplace(make_pair(current, target));
+            // split the touched blocks
+            for (const Group group : touched) {
+                const size_t start = blockStart[group];
+                const size_t end = blockEnd[group];
+                const size_t border = start + marked[group];
+                marked[group] = 0;
+
+                if (border == end) continue;
+
+                const Group created = blockStart.size();
+                if (border - start <= end - border) {
+                    blockStart.emplace_back(start);
+                    blockEnd.emplace_back(border);
+                    blockStart[group] = border;
+                } else {
+                    blockStart.emplace_back(border);
+                    blockEnd.emplace_back(end);
+                    blockEnd[group] = border;
+                }
+                marked.emplace_back(0);
 
-            ++itr1; ++itr2;
+                for (size_t i = blockStart[created]; i < blockEnd[created]; ++i)
+                    blockOf[elements[i]] = created;
+                worklist.emplace_back(created);
+            }
+            touched.clear();
         }
+    }
+
+    // groups are named [0, n>, missing transitions stay missing
+    Table result(table.m_Alphabet);
+    for (Group group = 0; group < blockStart.size(); ++group)
+        result.addState(table.m_Final[elements[blockStart[group]]]);
 
-        queue.pop();
+    for (Group group = 0; group < blockStart.size(); ++group) {
+        const State* source = table.row(elements[blockStart[group]]);
+        State* row = result.row(group);
+
+        for (Column column = 0; column < width; ++column)
+            row[column] = source[column] == noState ? noState : blockOf[source[column]];
     }
-    return transitions;
+
+    result.m_Initial = blockOf[table.m_Initial];
+    return result;
 }
 
-bool parallelRunAddInFinal(
-        const DFA& dfa1,
-        const DFA& dfa2,
-        const DoubleState& state,
-        const bool isIntersect
-        ) {
-    const set<State>& fin1 = dfa1.m_FinalStates;
-    const set<State>& fin2 = dfa2.m_FinalStates;
+Table minimizeBrzozowski(const Table& table, const Options& options);
 
-    // checks if the state is final
-    if (isIntersect) {
-        return (fin1.count(get<0>(state)) && fin2.count(get<1>(state)));
-    } else {
-        return (fin1.count(get<0>(state)) || fin2.count(get<1>(state)));
+Table minimize(const Table& table, const Options& options = {}) {
+    Statistics* statistics = options.m_Statistics;
+
+    // removeUnreachable - removed by prev algorithms
+    const Table ready = statisticsStage(statistics, "minimizeRemoveUseless",
+            [&](StageStatistics*) { return minimizeRemoveUseless(table); });
+
+    switch (options.m_Minimizer) {
+        case Minimizer::Moore:
+            return statisticsStage(statistics, "minimizeEquiv",
+                    [&](StageStatistics* stage) { return minimizeEquiv(ready, stage, options.m_Threads); });
+        case Minimizer::Hopcroft:
+            return statisticsStage(statistics, "minimizeHopcroft",
+                    [&](StageStatistics* stage) { return minimizeHopcroft(ready, stage); });
+        case Minimizer::Brzozowski:
+            return statisticsStage(statistics, "minimizeBrzozowski",
+                    [&](StageStatistics*) { return minimizeBrzozowski(ready, options); });
     }
+    // the switch covers all the minimizers
+    assert(false);
+    return ready;
 }
 
+
+// --- Parallel run -----------------------------------------------------------
+
+using DoubleState = pair<State, State>;
+
+/** Pseudo state standing for any state accepting all the words */
+const State universalState = noState - 1;
+
+enum class StateKind : uint8_t { Normal, Dead, Universal };
+
 /**
- * Renames nodes according to the previously generated mapping 
- * and creates the finite notes set. Puts it all into the final DFA */
-DFA parallelRunApplyNaming(
-        const DFA& dfa1,
-        const DFA& dfa2,
-        const map<DoubleConfig, DoubleState>& transitions,
-        const map<DoubleState, State>& nameMaping,
-        const bool isIntersect
+ * Finds the states no final state is reachable from (dead) and the states
+ * accepting all the words (universal). Targets(state, column) returns
+ * the [begin, end) range of the targets. For a nondeterministic automat
+ * the universal states are only underapproximated: a final state is
+ * universal if for every symbol some of its targets is universal. */
+template<typename Targets>
+vector<StateKind> classifyStates(
+        const size_t size,
+        const size_t width,
+        const vector<bool>& final,
+        const Targets& targets
         ) {
+    // reversed edges, stored as (state * width + column) keys
+    vector<size_t> offsets(size + 1, 0);
+    for (State state = 0; state < size; ++state) {
+        for (Column column = 0; column < width; ++column) {
+            const auto [begin, end] = targets(state, column);
+            for (const State* itr = begin; itr != end; ++itr)
+                ++offsets[*itr + 1];
+        }
+    }
+    partial_sum(offsets.begin(), offsets.end(), offsets.begin());
 
-    // states are just integers in [0, n>
-    set<State> newStates = {0}; // the initial state must be always presented
-    for (size_t i = 0; i < nameMaping.size(); ++i)
-        newStates.emplace(i);
+    vector<size_t> parents(offsets.back());
+    {
+        vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (State state = 0; state < size; ++state) {
+            for (Column column = 0; column < width; ++column) {
+                const auto [begin, end] = targets(state, column);
+                for (const State* itr = begin; itr != end; ++itr)
+                    parents[fill[*itr]++] = (size_t) state * width + column;
+            }
+        }
+    }
 
-    map<Config, State> newTransitions;
-    set<State> newFinite;
+    vector<StateKind> kinds(size, StateKind::Dead);
+    vector<State> stack;
 
-    // make sure initial state is always present
-    {
-        const DoubleState initial = {dfa1.m_InitialState, dfa2.m_InitialState};
-        if (parallelRunAddInFinal(dfa1, dfa2, initial, isIntersect))
-            newFinite.emplace(nameMaping.at(initial));
+    // everything that can reach a final state is alive
+    for (State state = 0; state < size; ++state) {
+        if (final[state]) {
+            kinds[state] = StateKind::Normal;
+            stack.emplace_back(state);
+        }
+    }
+    while (!stack.empty()) {
+        const State state = stack.back();
+        stack.pop_back();
+
+        for (size_t i = offsets[state]; i < offsets[state + 1]; ++i) {
+            const State parent = parents[i] / width;
+            if (kinds[parent] == StateKind::Dead) {
+                kinds[parent] = StateKind::Normal;
+                stack.emplace_back(parent);
+            }
+        }
     }
 
-    for (const auto& transition : transitions) {
-        const auto& [setConfig, dest] = transition;
-        const auto [state, symbol] = setConfig;
+    // the greatest fixpoint, starts with all the final states
+    // and removes the ones with a symbol having no universal target
+    vector<size_t> universalTargets(size * width, 0);
+    for (State state = 0; state < size; ++state) {
+        for (Column column = 0; column < width; ++column) {
+            const auto [begin, end] = targets(state, column);
+            universalTargets[(size_t) state * width + column] =
+                count_if(begin, end, [&](const State target) { return final[target]; });
+        }
+    }
+
+    vector<bool> universal = final;
+    for (State state = 0; state < size; ++state) {
+        const size_t* counts = universalTargets.data() + (size_t) state * width;
+        if (universal[state] && find(counts, counts + width, 0) != counts + width) {
+            universal[state] = false;
+            stack.emplace_back(state);
+        }
+    }
+    while (!stack.empty()) {
+        const State state = stack.back();
+        stack.pop_back();
+
+        for (size_t i = offsets[state]; i < offsets[state + 1]; ++i) {
+            const State parent = parents[i] / width;
+            if (--universalTargets[parents[i]] == 0 && universal[parent]) {
+                universal[parent] = false;
+                stack.emplace_back(parent);
+            }
+        }
+    }
+
+    for (State state = 0; state < size; ++state)
+        if (universal[state])
+            kinds[state] = StateKind::Universal;
+
+    return kinds;
+}
+
+vector<StateKind> parallelRunKinds(const Table& table) {
+    const auto targets = [&](const State state, const Column column) {
+        const State* target = table.row(state) + column;
+        return make_pair(target, target + (*target != noState));
+    };
+    return classifyStates(table.size(), table.width(), table.m_Final, targets);
+}
+
+template<typename Source>
+vector<StateKind> nfaKinds(const Source& nfa) {
+    const auto targets = [&](const State state, const Column column) {
+        return make_pair(nfa.targetsBegin(state, column), nfa.targetsEnd(state, column));
+    };
+    return classifyStates(nfa.size(), nfa.width(), nfa.m_Final, targets);
+}
+
+/**
+ * Dead components are replaced by the sink, for intersect the whole pair
+ * is dead then. For union a pair with an universal component accepts
+ * everything. Such pairs are collapsed into a single product state. */
+template<typename Kinds>
+DoubleState parallelRunCanonical(
+        DoubleState state,
+        const Kinds& kinds1,
+        const Kinds& kinds2,
+        const bool isIntersect
+        ) {
+    if (state.first == universalState)
+        return state;
+
+    if (state.first  != noState && kinds1[state.first]  == StateKind::Dead) state.first  = noState;
+    if (state.second != noState && kinds2[state.second] == StateKind::Dead) state.second = noState;
+
+    if (isIntersect) {
+        if (state.first == noState || state.second == noState)
+            return {noState, noState};
+    } else {
+        if ((state.first  != noState && kinds1[state.first]  == StateKind::Universal) ||
+            (state.second != noState && kinds2[state.second] == StateKind::Universal))
+            return {universalState, universalState};
+    }
+    return state;
+}
+
+/** Packs both the states into a single hashable key */
+uint64_t parallelRunKey(const DoubleState& state) {
+    return ((uint64_t) state.first << 32) | state.second;
+}
+
+template<typename Operand>
+bool parallelRunAddInFinal(
+        const Operand& dfa1,
+        const Operand& dfa2,
+        const DoubleState& state,
+        const bool isIntersect
+        ) {
+    if (state.first == universalState)
+        return true;
+
+    // the sink is never final
+    const bool fin1 = state.first  != noState && dfa1.isFinal(state.first);
+    const bool fin2 = state.second != noState && dfa2.isFinal(state.second);
+
+    // checks if the state is final
+    if (isIntersect) {
+        return fin1 && fin2;
+    } else {
+        return fin1 || fin2;
+    }
+}
+
+/** Performs the parallel run algorithm
+ * both automates must have the same alphabet
+ * missing transitions lead to an implicit sink, so the automates need not be full,
+ * the dead pair is not materialized either, transitions into it stay missing
+ * states are named in the BFS order */
+template<typename Operand>
+Table parallelRun(Operand& dfa1, Operand& dfa2, const bool isIntersect, StageStatistics* stage = nullptr) {
+    const size_t width = dfa1.width();
+
+    Table result(dfa1.m_Alphabet);
+    unordered_map<uint64_t, State> names;
+    vector<DoubleState> order;
+
+    // the lazy operands classify the states as they are discovered
+    const auto& kinds1 = parallelRunKinds(dfa1);
+    const auto& kinds2 = parallelRunKinds(dfa2);
+
+    const auto discover = [&](DoubleState state) -> State {
+        state = parallelRunCanonical(state, kinds1, kinds2, isIntersect);
+        if (state == DoubleState{noState, noState} && !order.empty())
+            return noState;
+
+        const auto [itr, inserted] = names.emplace(parallelRunKey(state), result.size());
+        if (inserted) {
+            result.addState(parallelRunAddInFinal(dfa1, dfa2, state, isIntersect));
+            order.emplace_back(state);
+        }
+        return itr -> second;
+    };
+
+    discover({dfa1.m_Initial, dfa2.m_Initial});
+
+    // BFS, order works as the queue
+    for (State current = 0; current < order.size(); ++current) {
+        statisticsQueue(stage, order.size() - current);
+        const auto [state1, state2] = order[current];
+
+        if (state1 == universalState) {
+            fill(result.row(current), result.row(current) + width, current);
+            continue;
+        }
+
+        const State* row1 = state1 == noState ? nullptr : dfa1.row(state1);
+        const State* row2 = state2 == noState ? nullptr : dfa2.row(state2);
+
+        for (Column column = 0; column < width; ++column) {
+            const State target1 = row1 == nullptr ? noState : row1[column];
+            const State target2 = row2 == nullptr ? noState : row2[column];
+            const State target = discover({target1, target2});
+            result.row(current)[column] = target;
+        }
+    }
+
+    result.m_Initial = 0;
+    return result;
+}
+
+#ifdef HAS_THREADS
+DoubleState parallelRunUnpack(const uint64_t key) {
+    return {(State) (key >> 32), (State) key};
+}
+
+/**
+ * Visited pairs of the concurrent product, open addressing over the packed keys.
+ * Inserting is lock-free, the table grows only between the BFS levels. */
+struct ConcurrentPairSet {
+    /** Never a product state, universal pairs have both the components universal */
+    static constexpr uint64_t emptyKey = ((uint64_t) universalState << 32) | noState;
+
+    vector<atomic<uint64_t>> m_Keys = vector<atomic<uint64_t>>(0);
+    vector<size_t> m_Values;    // filled in by the caller between the levels
+    size_t m_Size = 0;
+
+    static size_t hash(uint64_t key) {
+        key = (key ^ (key >> 29)) * 0xbf58476d1ce4e5b9ull;
+        return key ^ (key >> 32);
+    }
+
+    /** Makes room for count keys in total, not thread safe */
+    void reserve(const size_t count) {
+        if (2 * count <= m_Keys.size()) return;
+
+        size_t capacity = 16;
+        while (capacity < 2 * count) capacity *= 2;
+
+        vector<atomic<uint64_t>> keys(capacity);
+        vector<size_t> values(capacity);
+        for (atomic<uint64_t>& key : keys)
+            key.store(emptyKey, memory_order_relaxed);
+
+        for (size_t slot = 0; slot < m_Keys.size(); ++slot) {
+            const uint64_t key = m_Keys[slot].load(memory_order_relaxed);
+            if (key == emptyKey) continue;
+
+            size_t target = hash(key) & (capacity - 1);
+            while (keys[target].load(memory_order_relaxed) != emptyKey)
+                target = (target + 1) & (capacity - 1);
+            keys[target].store(key, memory_order_relaxed);
+            values[target] = m_Values[slot];
+        }
+        m_Keys.swap(keys);
+        m_Values.swap(values);
+    }
+
+    /** Returns the slot of the key and whether it has just been inserted */
+    pair<size_t, bool> insert(const uint64_t key) {
+        const size_t mask = m_Keys.size() - 1;
+        for (size_t slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+            uint64_t current = m_Keys[slot].load(memory_order_acquire);
+            if (current == emptyKey && m_Keys[slot].compare_exchange_strong(current, key))
+                return {slot, true};
+            if (current == key)
+                return {slot, false};
+        }
+    }
+
+    size_t find(const uint64_t key) const {
+        const size_t mask = m_Keys.size() - 1;
+        size_t slot = hash(key) & mask;
+        while (m_Keys[slot].load(memory_order_relaxed) != key)
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+};
+
+/**
+ * The parallel run with each BFS level expanded by several workers.
+ * Pairs get dense indices in the order the workers happen to create them,
+ * the final BFS renumbering gives the same table as parallelRun. */
+Table parallelRunConcurrent(const Table& dfa1, const Table& dfa2, const bool isIntersect, const size_t threads) {
+    const size_t width = dfa1.width();
+    const size_t chunk = 256;
+    const uint64_t missing = ConcurrentPairSet::emptyKey;
+
+    const vector<StateKind> kinds1 = parallelRunKinds(dfa1);
+    const vector<StateKind> kinds2 = parallelRunKinds(dfa2);
+
+    ConcurrentPairSet visited;
+    vector<uint64_t> pairs;     // dense index -> key
+    vector<uint64_t> targets;   // dense index * width + column -> target key, later its index
+    vector<vector<size_t>> created(max<size_t>(threads, 1));
+
+    const uint64_t initial = parallelRunKey(parallelRunCanonical(
+                DoubleState{dfa1.m_Initial, dfa2.m_Initial}, kinds1, kinds2, isIntersect));
+    visited.reserve(1);
+    visited.m_Values[visited.insert(initial).first] = 0;
+    pairs.emplace_back(initial);
+
+    const auto expand = [&](const size_t id, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto [state1, state2] = parallelRunUnpack(pairs[i]);
+            uint64_t* row = targets.data() + i * width;
+
+            if (state1 == universalState) {
+                fill(row, row + width, pairs[i]);
+                continue;
+            }
+
+            const State* row1 = state1 == noState ? nullptr : dfa1.row(state1);
+            const State* row2 = state2 == noState ? nullptr : dfa2.row(state2);
+
+            for (Column column = 0; column < width; ++column) {
+                const DoubleState target = parallelRunCanonical(DoubleState{
+                        row1 == nullptr ? noState : row1[column],
+                        row2 == nullptr ? noState : row2[column]}, kinds1, kinds2, isIntersect);
+
+                // the dead pair is not materialized
+                if (target == DoubleState{noState, noState}) {
+                    row[column] = missing;
+                    continue;
+                }
+
+                row[column] = parallelRunKey(target);
+                const auto [slot, inserted] = visited.insert(row[column]);
+                if (inserted)
+                    created[id].emplace_back(slot);
+            }
+        }
+    };
+
+    // BFS by levels, the new pairs are indexed between the levels
+    for (size_t levelBegin = 0; levelBegin < pairs.size();) {
+        const size_t levelEnd = pairs.size();
+        visited.reserve(levelEnd + (levelEnd - levelBegin) * width);
+        targets.resize(levelEnd * width);
+
+        parallelChunks(threads, levelEnd - levelBegin, chunk,
+                [&](const size_t id, const size_t begin, const size_t end) {
+                    expand(id, levelBegin + begin, levelBegin + end);
+                });
+
+        for (vector<size_t>& slots : created) {
+            for (const size_t slot : slots) {
+                visited.m_Values[slot] = pairs.size();
+                pairs.emplace_back(visited.m_Keys[slot].load(memory_order_relaxed));
+            }
+            slots.clear();
+        }
+        levelBegin = levelEnd;
+    }
+
+    parallelChunks(threads, targets.size(), chunk * width,
+            [&](size_t, const size_t begin, const size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                    if (targets[i] != missing)
+                        targets[i] = visited.m_Values[visited.find(targets[i])];
+            });
+
+    // BFS renumbering, order works as the queue
+    Table result(dfa1.m_Alphabet);
+    vector<State> naming(pairs.size(), noState);
+    vector<size_t> order = {0};
+    naming[0] = result.addState(parallelRunAddInFinal(dfa1, dfa2, parallelRunUnpack(pairs[0]), isIntersect));
+
+    for (State current = 0; current < order.size(); ++current) {
+        const uint64_t* row = targets.data() + order[current] * width;
+
+        for (Column column = 0; column < width; ++column) {
+            if (row[column] == missing) continue;
+
+            State& name = naming[row[column]];
+            if (name == noState) {
+                name = result.addState(parallelRunAddInFinal(
+                            dfa1, dfa2, parallelRunUnpack(pairs[row[column]]), isIntersect));
+                order.emplace_back(row[column]);
+            }
+            result.row(current)[column] = name;
+        }
+    }
+
+    result.m_Initial = 0;
+    return result;
+}
+#endif
+
+
+// --- Full automat -----------------------------------------------------------
+
+/** Adds the fail state and redirects all the missing transitions into it */
+Table makeFull(Table table) {
+    const State failState = table.addState(false);
+
+    for (State& target : table.m_Transitions)
+        if (target == noState)
+            target = failState;
+
+    return table;
+}
+
+// --- Determinization --------------------------------------------------------
+
+/**
+ * Stores each discovered subset only once, sorted and back to back
+ * in a single array, and names them by [0, n> in the discovery order.
+ * Lookups go through an open addressing hash table of the names. */
+struct SubsetPool {
+    vector<State> m_Data;
+    vector<size_t> m_Offsets = {0};
+    vector<uint64_t> m_Hashes;
+    vector<State> m_Slots = vector<State>(16, noState);
+
+    size_t size() const { return m_Hashes.size(); }
+
+    const State* begin(const State name) const { return m_Data.data() + m_Offsets[name]; }
+    const State* end  (const State name) const { return m_Data.data() + m_Offsets[name + 1]; }
+
+    /** Returns the name of the subset and whether it has just been created */
+    pair<State, bool> intern(const State* begin, const State* end) {
+        if (2 * (size() + 1) > m_Slots.size())
+            grow();
+
+        const uint64_t hash = subsetHash(begin, end);
+        const size_t mask = m_Slots.size() - 1;
+
+        size_t slot = hash & mask;
+        for (; m_Slots[slot] != noState; slot = (slot + 1) & mask) {
+            const State name = m_Slots[slot];
+            if (m_Hashes[name] == hash && equal(begin, end, this -> begin(name), this -> end(name)))
+                return {name, false};
+        }
+
+        const State name = size();
+        m_Slots[slot] = name;
+        m_Hashes.emplace_back(hash);
+        m_Data.insert(m_Data.end(), begin, end);
+        m_Offsets.emplace_back(m_Data.size());
+        return {name, true};
+    }
+
+    void grow() {
+        vector<State> slots(2 * m_Slots.size(), noState);
+        const size_t mask = slots.size() - 1;
+
+        for (State name = 0; name < size(); ++name) {
+            size_t slot = m_Hashes[name] & mask;
+            while (slots[slot] != noState)
+                slot = (slot + 1) & mask;
+            slots[slot] = name;
+        }
+        m_Slots.swap(slots);
+    }
+};
+
+/** Collects all the targets of the subset given, sorted and unique, for each column */
+template<typename Source>
+void determinizeSuccessors(
+        const Source& nfa,
+        const State* begin,
+        const State* end,
+        vector<vector<State>>& results
+        ) {
+    const size_t width = nfa.width();
+
+    // iterate over all the nodes in state set
+    for (const State* state = begin; state != end; ++state)
+        for (Column column = 0; column < width; ++column)
+            results[column].insert(results[column].end(),
+                    nfa.targetsBegin(*state, column), nfa.targetsEnd(*state, column));
+
+    for (vector<State>& targets : results) {
+        sort(targets.begin(), targets.end());
+        targets.erase(unique(targets.begin(), targets.end()), targets.end());
+    }
+}
+
+// word-wise OR kernels, the best one is picked at runtime
+using OrKernel = void (*)(uint64_t*, const uint64_t*, size_t);
+
+void orWordsScalar(uint64_t* dest, const uint64_t* src, const size_t words) {
+    for (size_t i = 0; i < words; ++i)
+        dest[i] |= src[i];
+}
+
+#ifdef HAS_X86_KERNELS
+__attribute__((target("sse2")))
+void orWordsSSE(uint64_t* dest, const uint64_t* src, const size_t words) {
+    size_t i = 0;
+    for (; i + 2 <= words; i += 2) {
+        const __m128i a = _mm_loadu_si128((const __m128i*) (dest + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dest + i), _mm_or_si128(a, b));
+    }
+    orWordsScalar(dest + i, src + i, words - i);
+}
+
+__attribute__((target("avx2")))
+void orWordsAVX(uint64_t* dest, const uint64_t* src, const size_t words) {
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*) (dest + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i*) (src + i));
+        _mm256_storeu_si256((__m256i*) (dest + i), _mm256_or_si256(a, b));
+    }
+    orWordsScalar(dest + i, src + i, words - i);
+}
+#endif
+
+OrKernel orKernel() {
+    static const OrKernel kernel = []() -> OrKernel {
+#ifdef HAS_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return orWordsAVX;
+        if (__builtin_cpu_supports("sse2")) return orWordsSSE;
+#endif
+        return orWordsScalar;
+    }();
+    return kernel;
+}
+
+/**
+ * Targets of each (state, column) pair as a bitmap over the NFA states,
+ * rows are m_Words long and indexed the same way as NFATable::m_Offsets. */
+struct SuccessorBitmaps {
+    size_t m_Words;
+    vector<uint64_t> m_Rows;
+    vector<bool> m_Empty;
+
+    template<typename Source>
+    explicit SuccessorBitmaps(const Source& nfa)
+        : m_Words((nfa.size() + 63) / 64),
+          m_Rows(nfa.size() * nfa.width() * m_Words, 0),
+          m_Empty(nfa.size() * nfa.width(), true) {
+
+        for (State state = 0; state < nfa.size(); ++state) {
+            for (Column column = 0; column < nfa.width(); ++column) {
+                const size_t key = (size_t) state * nfa.width() + column;
+                uint64_t* row = m_Rows.data() + key * m_Words;
+
+                for (const State* itr = nfa.targetsBegin(state, column); itr != nfa.targetsEnd(state, column); ++itr) {
+                    row[*itr / 64] |= (uint64_t) 1 << (*itr % 64);
+                    m_Empty[key] = false;
+                }
+            }
+        }
+    }
+
+    const uint64_t* row(const size_t key) const { return m_Rows.data() + key * m_Words; }
+};
+
+/** Same as the list based version, but the targets are merged by ORing the bitmaps */
+void determinizeSuccessors(
+        const SuccessorBitmaps& bitmaps,
+        const size_t width,
+        const State* begin,
+        const State* end,
+        vector<uint64_t>& accumulator,
+        vector<vector<State>>& results
+        ) {
+    const size_t words = bitmaps.m_Words;
+    const OrKernel kernel = orKernel();
+    accumulator.assign(words, 0);
+
+    for (Column column = 0; column < width; ++column) {
+        bool any = false;
+        for (const State* state = begin; state != end; ++state) {
+            const size_t key = (size_t) *state * width + column;
+            if (bitmaps.m_Empty[key]) continue;
+
+            kernel(accumulator.data(), bitmaps.row(key), words);
+            any = true;
+        }
+        if (!any) continue;
+
+        // decode the bitmap, clears it for the next column
+        vector<State>& targets = results[column];
+        for (size_t word = 0; word < words; ++word) {
+            uint64_t bits = accumulator[word];
+            while (bits != 0) {
+                targets.emplace_back(word * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+            accumulator[word] = 0;
+        }
+    }
+}
+
+/** Simulation is computed only up to this many states, it takes a quadratic space */
+const size_t simulationLimit = 1024;
+
+/**
+ * Direct simulation preorder, bit q of row p is set if q simulates p:
+ * q is final if p is and each move of p can be followed by a move of q
+ * into a state simulating the target. Refined from the finality until stable. */
+struct Simulation {
+    size_t m_Words;
+    vector<uint64_t> m_Rows;
+
+    template<typename Source>
+    explicit Simulation(const Source& nfa)
+        : m_Words((nfa.size() + 63) / 64), m_Rows(nfa.size() * m_Words, 0) {
+
+        const size_t size = nfa.size();
+        const size_t width = nfa.width();
+
+        for (State state = 0; state < size; ++state)
+            for (State other = 0; other < size; ++other)
+                if (!nfa.m_Final[state] || nfa.m_Final[other])
+                    row(state)[other / 64] |= (uint64_t) 1 << (other % 64);
+
+        // bit q of predecessors[target * width + column] is set if q moves into target
+        vector<uint64_t> predecessors(size * width * m_Words, 0);
+        for (State state = 0; state < size; ++state)
+            for (Column column = 0; column < width; ++column)
+                for (const State* target = nfa.targetsBegin(state, column); target != nfa.targetsEnd(state, column); ++target)
+                    predecessors[((size_t) *target * width + column) * m_Words + state / 64] |= (uint64_t) 1 << (state % 64);
+
+        // the states that can follow a move into target, cached for a round
+        vector<uint64_t> follow(size * width * m_Words);
+        vector<size_t> followRound(size * width, 0);
+
+        for (size_t round = 1, changed = true; changed; ++round) {
+            changed = false;
+
+            for (State state = 0; state < size; ++state) {
+                for (Column column = 0; column < width; ++column) {
+                    for (const State* target = nfa.targetsBegin(state, column); target != nfa.targetsEnd(state, column); ++target) {
+                        const size_t key = (size_t) *target * width + column;
+                        uint64_t* followers = follow.data() + key * m_Words;
+
+                        if (followRound[key] != round) {
+                            followRound[key] = round;
+                            fill(followers, followers + m_Words, 0);
+                            for (State other = 0; other < size; ++other)
+                                if (simulates(*target, other))
+                                    for (size_t word = 0; word < m_Words; ++word)
+                                        followers[word] |= predecessors[((size_t) other * width + column) * m_Words + word];
+                        }
+
+                        uint64_t* current = row(state);
+                        for (size_t word = 0; word < m_Words; ++word) {
+                            const uint64_t next = current[word] & followers[word];
+                            changed = changed || next != current[word];
+                            current[word] = next;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * The relation between the classes of the states simulating each other,
+     * as between the representatives of the classes, it stays a simulation. */
+    Simulation(const Simulation& simulation, const vector<State>& representatives)
+        : m_Words((representatives.size() + 63) / 64), m_Rows(representatives.size() * m_Words, 0) {
+
+        for (State group = 0; group < representatives.size(); ++group)
+            for (State other = 0; other < representatives.size(); ++other)
+                if (simulation.simulates(representatives[group], representatives[other]))
+                    row(group)[other / 64] |= (uint64_t) 1 << (other % 64);
+    }
+
+    uint64_t* row(const State state) { return m_Rows.data() + (size_t) state * m_Words; }
+    const uint64_t* row(const State state) const { return m_Rows.data() + (size_t) state * m_Words; }
+
+    /** Whether other simulates state */
+    bool simulates(const State state, const State other) const {
+        return (row(state)[other / 64] >> (other % 64)) & 1;
+    }
+
+    /**
+     * Drops the states simulated by another state of the subset, from the states
+     * simulating each other the first one stays. Members is a scratch bitmap. */
+    void prune(vector<State>& subset, vector<uint64_t>& members) const {
+        members.assign(m_Words, 0);
+        for (const State state : subset)
+            members[state / 64] |= (uint64_t) 1 << (state % 64);
+
+        const auto subsumed = [&](const State state) {
+            for (size_t word = 0; word < m_Words; ++word) {
+                uint64_t bits = row(state)[word] & members[word];
+                while (bits != 0) {
+                    const State other = word * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    if (other != state && (other < state || !simulates(other, state)))
+                        return true;
+                }
+            }
+            return false;
+        };
+        subset.erase(remove_if(subset.begin(), subset.end(), subsumed), subset.end());
+    }
+};
+
+/**
+ * The relation pruning the subsets if the options ask for it. The one given
+ * (over the states of the automat) is used if there is one, otherwise
+ * it is computed up to simulationLimit states. */
+template<typename Source>
+shared_ptr<const Simulation> simulationFor(const Source& nfa, const Options& options, shared_ptr<const Simulation> given) {
+    if (options.m_Reduction != Reduction::Simulation) return nullptr;
+    if (given != nullptr) return given;
+    if (nfa.size() > simulationLimit) return nullptr;
+    return make_shared<const Simulation>(nfa);
+}
+
+/**
+ * Determinizes an automat only as far as the transitions are asked for.
+ * States are named in the order the subsets are interned in,
+ * missing transitions lead to the implicit sink (noState).
+ * The source is a NFATable or anything with the same read interface. */
+template<typename Source = NFATable>
+struct LazyTable {
+    const Source& m_NFA;
+    const vector<Symbol>& m_Alphabet;
+    SubsetPool m_Subsets;
+    Table m_Table;
+    vector<bool> m_Expanded;
+    vector<StateKind> m_NFAKinds;
+    vector<StateKind> m_Kinds;
+    State m_Initial = 0;
+
+    // holds all the states we can get to for the column given
+    vector<vector<State>> m_Results;
+    optional<SuccessorBitmaps> m_Bitmaps;
+    vector<uint64_t> m_Accumulator;
+    shared_ptr<const Simulation> m_Simulation;
+    vector<uint64_t> m_Members;
+
+    /** The simulation is the one nfaReduce has left, if any, see simulationFor */
+    LazyTable(const Source& nfa, const Options& options = {}, shared_ptr<const Simulation> simulation = nullptr)
+        : LazyTable(nfa, {nfa.m_Initial}, options, move(simulation)) {}
+
+    /** Starts from the sorted initial subset given instead of the initial state */
+    LazyTable(const Source& nfa, const vector<State>& initial, const Options& options = {},
+            shared_ptr<const Simulation> simulation = nullptr)
+        : m_NFA(nfa), m_Alphabet(nfa.m_Alphabet), m_Table(nfa.m_Alphabet), m_Results(nfa.width()) {
+
+        if (options.m_Successors == Successors::Bitsets)
+            m_Bitmaps.emplace(nfa);
+        m_Simulation = simulationFor(nfa, options, move(simulation));
+
+        m_NFAKinds = nfaKinds(nfa);
+
+        m_Initial = discover(initial.data(), initial.data() + initial.size());
+    }
+
+    size_t width() const { return m_Table.width(); }
+    size_t size()  const { return m_Table.size(); }
+    bool isFinal(const State state) const { return m_Table.isFinal(state); }
+
+    /** Forgets all the states, then starts again from the sorted initial subset given */
+    void reset(const vector<State>& initial) {
+        m_Subsets = SubsetPool();
+        m_Table = Table(m_Alphabet);
+        m_Expanded.clear();
+        m_Kinds.clear();
+        m_Initial = discover(initial.data(), initial.data() + initial.size());
+    }
+
+    /** The row is valid only until another state is expanded */
+    const State* row(const State state) {
+        if (!m_Expanded[state])
+            expand(state);
+        return m_Table.row(state);
+    }
+
+    State discover(const State* begin, const State* end) {
+        const auto [name, inserted] = m_Subsets.intern(begin, end);
+        if (inserted) {
+            m_Table.addState(any_of(begin, end, [&](const State state) { return m_NFA.m_Final[state]; }));
+            m_Expanded.push_back(false);
+            m_Kinds.push_back(subsetKind(begin, end));
+        }
+        return name;
+    }
+
+    /** A subset is dead if all its states are, universal if any of them is */
+    StateKind subsetKind(const State* begin, const State* end) const {
+        bool dead = true;
+        for (const State* state = begin; state != end; ++state) {
+            if (m_NFAKinds[*state] == StateKind::Universal) return StateKind::Universal;
+            if (m_NFAKinds[*state] != StateKind::Dead) dead = false;
+        }
+        return dead ? StateKind::Dead : StateKind::Normal;
+    }
+
+    void expand(const State state) {
+        const size_t width = m_Table.width();
+        m_Expanded[state] = true;
+
+        if (m_Bitmaps) {
+            determinizeSuccessors(*m_Bitmaps, width,
+                    m_Subsets.begin(state), m_Subsets.end(state), m_Accumulator, m_Results);
+        } else {
+            determinizeSuccessors(m_NFA, m_Subsets.begin(state), m_Subsets.end(state), m_Results);
+        }
+
+        // analyze the results
+        for (Column column = 0; column < width; ++column) {
+            vector<State>& targets = m_Results[column];
+            if (targets.empty()) continue;
+            if (m_Simulation)
+                m_Simulation -> prune(targets, m_Members);
+
+            const State target = discover(targets.data(), targets.data() + targets.size());
+            m_Table.row(state)[column] = target;
+            targets.clear();
+        }
+    }
+};
+
+template<typename Source>
+const vector<StateKind>& parallelRunKinds(const LazyTable<Source>& table) {
+    return table.m_Kinds;
+}
+
+#ifdef HAS_THREADS
+/**
+ * Subsets shared by the determinization workers, split into shards by
+ * the subset hash, so the workers rarely wait for the same lock.
+ * A name holds the shard index in its low bits, the name within the shard above,
+ * so a shard holds less than shardNames of them and the names stay below noState. */
+struct ConcurrentSubsetPool {
+    static constexpr size_t shardBits = 6;
+    static constexpr size_t shardCount = (size_t) 1 << shardBits;
+    static constexpr size_t shardNames = ((size_t) noState >> shardBits) - 1;
+
+    struct Shard {
+        mutex m_Lock;
+        SubsetPool m_Subsets;
+    };
+    array<Shard, shardCount> m_Shards;
+
+    /** Returns the name of the subset and whether it has just been created, noState if the shard is full */
+    pair<State, bool> intern(const State* begin, const State* end) {
+        const size_t index = subsetHash(begin, end) >> (64 - shardBits);
+        Shard& shard = m_Shards[index];
+
+        lock_guard<mutex> lock(shard.m_Lock);
+        const auto [name, inserted] = shard.m_Subsets.intern(begin, end);
+        if (name >= shardNames) return {noState, false};
+        return {(State) (name << shardBits | index), inserted};
+    }
+
+    /** Copies the subset out, the shard storage may move when another one is interned */
+    void subset(const State name, vector<State>& out) {
+        Shard& shard = m_Shards[name & (shardCount - 1)];
+        const State local = name >> shardBits;
+
+        lock_guard<mutex> lock(shard.m_Lock);
+        out.assign(shard.m_Subsets.begin(local), shard.m_Subsets.end(local));
+    }
+};
+
+/** Tasks of a single worker, the owner works at the back, the thieves take the front */
+struct StealingQueue {
+    mutex m_Lock;
+    deque<State> m_Tasks;
+
+    void push(const State state) {
+        lock_guard<mutex> lock(m_Lock);
+        m_Tasks.emplace_back(state);
+    }
+
+    bool pop(State& state) {
+        lock_guard<mutex> lock(m_Lock);
+        if (m_Tasks.empty()) return false;
+        state = m_Tasks.back();
+        m_Tasks.pop_back();
+        return true;
+    }
+
+    bool steal(State& state) {
+        lock_guard<mutex> lock(m_Lock);
+        if (m_Tasks.empty()) return false;
+        state = m_Tasks.front();
+        m_Tasks.pop_front();
+        return true;
+    }
+};
+
+/**
+ * Subset construction expanded by options.m_Threads workers at once.
+ * The workers name the subsets in the order they happen to intern them,
+ * the final BFS renumbering gives the same table as the sequential version.
+ * The workers with nothing to steal sleep until a task is queued.
+ * Returns nullopt if a shard runs out of names, the caller goes sequential then. */
+optional<Table> determinizeParallel(const NFATable& nfa, const Options& options, shared_ptr<const Simulation> given) {
+    const size_t width = nfa.width();
+    const size_t threads = options.m_Threads;
+
+    optional<SuccessorBitmaps> bitmaps;
+    if (options.m_Successors == Successors::Bitsets)
+        bitmaps.emplace(nfa);
+    const shared_ptr<const Simulation> simulation = simulationFor(nfa, options, move(given));
+
+    // rows of the expanded subsets, in the order the worker expanded them
+    struct Expanded {
+        vector<State> m_Names;
+        vector<bool> m_Final;
+        vector<State> m_Rows;
+    };
+
+    ConcurrentSubsetPool pool;
+    vector<StealingQueue> queues(threads);
+    vector<Expanded> expanded(threads);
+
+    // subsets queued or being expanded, the work is done once it drops to 0
+    atomic<size_t> pending(1);
+    // subsets in the queues and the workers waiting for them
+    atomic<size_t> queued(1);
+    atomic<size_t> sleeping(0);
+    atomic<bool> overflow(false);
+    mutex idleLock;
+    condition_variable idle;
+
+    const State initial = pool.intern(&nfa.m_Initial, &nfa.m_Initial + 1).first;
+    queues[0].push(initial);
+
+    const auto work = [&](const size_t id) {
+        vector<vector<State>> results(width);
+        vector<uint64_t> accumulator;
+        vector<uint64_t> members;
+        vector<State> subset;
+        Expanded& mine = expanded[id];
+
+        while (!overflow) {
+            State current;
+            bool found = queues[id].pop(current);
+            for (size_t i = 1; i < threads && !found; ++i)
+                found = queues[(id + i) % threads].steal(current);
+
+            if (!found) {
+                // a pusher seeing no sleeper has its task counted before the check
+                unique_lock<mutex> lock(idleLock);
+                ++sleeping;
+                idle.wait(lock, [&]() { return pending == 0 || queued != 0 || overflow; });
+                --sleeping;
+                if (pending == 0 || overflow) return;
+                continue;
+            }
+            --queued;
+
+            pool.subset(current, subset);
+            const State* begin = subset.data();
+            const State* end = subset.data() + subset.size();
+            if (bitmaps) {
+                determinizeSuccessors(*bitmaps, width, begin, end, accumulator, results);
+            } else {
+                determinizeSuccessors(nfa, begin, end, results);
+            }
+
+            mine.m_Names.emplace_back(current);
+            mine.m_Final.push_back(any_of(begin, end, [&](const State state) { return nfa.m_Final[state]; }));
+
+            for (Column column = 0; column < width; ++column) {
+                vector<State>& targets = results[column];
+                State target = noState;
+
+                if (!targets.empty()) {
+                    if (simulation)
+                        simulation -> prune(targets, members);
+
+                    const auto [name, inserted] = pool.intern(targets.data(), targets.data() + targets.size());
+                    if (name == noState) {
+                        lock_guard<mutex> lock(idleLock);
+                        overflow = true;
+                        idle.notify_all();
+                        return;
+                    }
+                    if (inserted) {
+                        ++pending;
+                        queues[id].push(name);
+                        ++queued;
+                        if (sleeping != 0) {
+                            lock_guard<mutex> lock(idleLock);
+                            idle.notify_one();
+                        }
+                    }
+                    target = name;
+                    targets.clear();
+                }
+                mine.m_Rows.emplace_back(target);
+            }
+
+            if (--pending == 0) {
+                lock_guard<mutex> lock(idleLock);
+                idle.notify_all();
+            }
+        }
+    };
+
+    vector<thread> workers;
+    for (size_t id = 1; id < threads; ++id)
+        workers.emplace_back(work, id);
+    work(0);
+    for (thread& worker : workers)
+        worker.join();
+    if (overflow) return nullopt;
+
+    // dense indices of the names, shard by shard
+    array<size_t, ConcurrentSubsetPool::shardCount + 1> shardOffsets = {0};
+    for (size_t shard = 0; shard < ConcurrentSubsetPool::shardCount; ++shard)
+        shardOffsets[shard + 1] = shardOffsets[shard] + pool.m_Shards[shard].m_Subsets.size();
+
+    const auto index = [&](const State name) {
+        return shardOffsets[name & (ConcurrentSubsetPool::shardCount - 1)] + (name >> ConcurrentSubsetPool::shardBits);
+    };
+
+    // the worker and the position each subset was expanded at
+    vector<pair<size_t, size_t>> location(shardOffsets.back());
+    for (size_t id = 0; id < threads; ++id)
+        for (size_t i = 0; i < expanded[id].m_Names.size(); ++i)
+            location[index(expanded[id].m_Names[i])] = {id, i};
+
+    const auto isFinal = [&](const State name) {
+        const auto [id, position] = location[index(name)];
+        return (bool) expanded[id].m_Final[position];
+    };
+
+    // BFS renumbering, order works as the queue
+    Table result(nfa.m_Alphabet);
+    vector<State> naming(shardOffsets.back(), noState);
+    vector<State> order = {initial};
+    naming[index(initial)] = result.addState(isFinal(initial));
+
+    for (State current = 0; current < order.size(); ++current) {
+        const auto [id, position] = location[index(order[current])];
+        const State* row = expanded[id].m_Rows.data() + position * width;
+
+        for (Column column = 0; column < width; ++column) {
+            if (row[column] == noState) continue;
+
+            State& name = naming[index(row[column])];
+            if (name == noState) {
+                name = result.addState(isFinal(row[column]));
+                order.emplace_back(row[column]);
+            }
+            result.row(current)[column] = name;
+        }
+    }
+
+    result.m_Initial = 0;
+    return result;
+}
+#endif
+
+/**
+ * Determinizes an automat, states are named in the BFS order,
+ * which is also the order the subsets are interned in. */
+Table determinize(const NFATable& nfa, const Options& options = {}, StageStatistics* stage = nullptr,
+        shared_ptr<const Simulation> simulation = nullptr) {
+#ifdef HAS_THREADS
+    if (options.m_Threads > 1)
+        if (optional<Table> table = determinizeParallel(nfa, options, simulation))
+            return move(*table);
+#endif
+
+    LazyTable lazy(nfa, options, move(simulation));
+
+    // BFS, the subsets are named in the order they are discovered
+    for (State current = 0; current < lazy.size(); ++current) {
+        statisticsQueue(stage, lazy.size() - current);
+        lazy.expand(current);
+    }
+
+    return move(lazy.m_Table);
+}
+
+/**
+ * Determinizes an automat over the alphabet given,
+ * it must contain the automat's alphabet. */
+Table determinize(const NFA& nfa, const set<Symbol>& alphabet, const Options& options = {}) {
+    return determinize(nfaCompile(nfa, alphabet), options);
+}
+
+/** Determinizes an automat */
+Table determinize(const NFA& nfa) {
+    return determinize(nfa, nfa.m_Alphabet);
+}
+
+// --- NFA reduction ----------------------------------------------------------
+
+/**
+ * Names the classes of the forward bisimulation by [0, n>. The states of
+ * a class have the same finality and reach the same classes by each column.
+ * Each round interns the signatures of the states, it stops once
+ * no class is split anymore. */
+vector<Group> nfaBisimulation(const NFATable& nfa) {
+    const size_t width = nfa.width();
+    const size_t size = nfa.size();
+
+    vector<Group> groups(size), next(size);
+    SubsetPool finality;
+    for (State state = 0; state < size; ++state) {
+        const State isFinal = nfa.m_Final[state];
+        groups[state] = finality.intern(&isFinal, &isFinal + 1).first;
+    }
+    size_t count = finality.size();
+
+    vector<State> signature;
+    while (true) {
+        SubsetPool signatures;
+
+        // the own class, then the sorted target classes of each column, closed by noState
+        for (State state = 0; state < size; ++state) {
+            signature.assign(1, groups[state]);
+            for (Column column = 0; column < width; ++column) {
+                const size_t start = signature.size();
+                for (const State* target = nfa.targetsBegin(state, column); target != nfa.targetsEnd(state, column); ++target)
+                    signature.emplace_back(groups[*target]);
+
+                sort(signature.begin() + start, signature.end());
+                signature.erase(unique(signature.begin() + start, signature.end()), signature.end());
+                signature.emplace_back(noState);
+            }
+            next[state] = signatures.intern(signature.data(), signature.data() + signature.size()).first;
+        }
+
+        groups.swap(next);
+        if (signatures.size() == count) break;
+        count = signatures.size();
+    }
+    return groups;
+}
+
+/** Names the classes of the states simulating each other by [0, n>, in the order of their first states */
+vector<Group> nfaSimulationClasses(const Simulation& simulation, const size_t size) {
+    vector<Group> groups(size, emptyGroup);
+    Group count = 0;
+    for (State state = 0; state < size; ++state) {
+        if (groups[state] != emptyGroup) continue;
+
+        groups[state] = count;
+        for (State other = state + 1; other < size; ++other)
+            if (simulation.simulates(state, other) && simulation.simulates(other, state))
+                groups[other] = count;
+        ++count;
+    }
+    return groups;
+}
+
+/** Merges the states of each class, a class gets the transitions of all its states */
+NFATable nfaQuotient(const NFATable& nfa, const vector<Group>& groups) {
+    const size_t width = nfa.width();
+    const size_t count = groups.empty() ? 0 : *max_element(groups.begin(), groups.end()) + 1;
+
+    vector<vector<State>> members(count);
+    for (State state = 0; state < nfa.size(); ++state)
+        members[groups[state]].emplace_back(state);
+
+    NFATable result(nfa.m_Alphabet);
+    result.m_Offsets.emplace_back(0);
+
+    for (Group group = 0; group < count; ++group) {
+        for (Column column = 0; column < width; ++column) {
+            const size_t start = result.m_Targets.size();
+            for (const State state : members[group])
+                for (const State* target = nfa.targetsBegin(state, column); target != nfa.targetsEnd(state, column); ++target)
+                    result.m_Targets.emplace_back(groups[*target]);
+
+            sort(result.m_Targets.begin() + start, result.m_Targets.end());
+            result.m_Targets.erase(unique(result.m_Targets.begin() + start, result.m_Targets.end()), result.m_Targets.end());
+            result.m_Offsets.emplace_back(result.m_Targets.size());
+        }
+        // the states of a class agree on the finality
+        result.m_Final.push_back(nfa.m_Final[members[group].front()]);
+    }
+
+    result.m_Initial = groups[nfa.m_Initial];
+    return result;
+}
+
+/**
+ * Merges the equivalent states as the reduction asks for, the simulation
+ * falls back to the bisimulation over simulationLimit states. If simulation
+ * is given, it gets the relation over the merged states, so the subset
+ * construction can prune by it without computing it again. */
+NFATable nfaReduce(const NFATable& nfa, const Reduction reduction, shared_ptr<const Simulation>* simulation = nullptr) {
+    switch (reduction) {
+        case Reduction::None:
+            return nfa;
+        case Reduction::Bisimulation:
+            return nfaQuotient(nfa, nfaBisimulation(nfa));
+        case Reduction::Simulation: {
+            if (nfa.size() > simulationLimit)
+                return nfaQuotient(nfa, nfaBisimulation(nfa));
+
+            const Simulation relation(nfa);
+            const vector<Group> groups = nfaSimulationClasses(relation, nfa.size());
+            if (simulation != nullptr) {
+                // the classes are named in the order of their first states
+                vector<State> representatives;
+                for (State state = 0; state < nfa.size(); ++state)
+                    if (groups[state] == representatives.size())
+                        representatives.emplace_back(state);
+                *simulation = make_shared<const Simulation>(relation, representatives);
+            }
+            return nfaQuotient(nfa, groups);
+        }
+    }
+    return nfa;
+}
+
+
+// --- Reversal ---------------------------------------------------------------
+
+/**
+ * Reverses all the transitions. The new initial state (named 0) takes over
+ * the reversed transitions of all the final states, the original initial
+ * state is the only final one. The other states are shifted by one. */
+NFATable nfaReverse(const NFATable& nfa) {
+    const size_t width = nfa.width();
+    const size_t size = nfa.size() + 1;
+
+    const auto reaches = [&](const State state, const Column column) {
+        return any_of(nfa.targetsBegin(state, column), nfa.targetsEnd(state, column),
+                [&](const State target) { return nfa.m_Final[target]; });
+    };
+
+    // reversed edges, indexed by state * width + column
+    vector<size_t> offsets(size * width + 1, 0);
+    for (State state = 0; state < nfa.size(); ++state) {
+        for (Column column = 0; column < width; ++column) {
+            for (const State* target = nfa.targetsBegin(state, column); target != nfa.targetsEnd(state, column); ++target)
+                ++offsets[(*target + 1) * width + column + 1];
+            if (reaches(state, column))
+                ++offsets[column + 1];
+        }
+    }
+    partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    NFATable result(nfa.m_Alphabet);
+    result.m_Targets.resize(offsets.back());
+    {
+        vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (State state = 0; state < nfa.size(); ++state) {
+            for (Column column = 0; column < width; ++column) {
+                for (const State* target = nfa.targetsBegin(state, column); target != nfa.targetsEnd(state, column); ++target)
+                    result.m_Targets[fill[(*target + 1) * width + column]++] = state + 1;
+                if (reaches(state, column))
+                    result.m_Targets[fill[column]++] = state + 1;
+            }
+        }
+    }
+    result.m_Offsets = move(offsets);
+
+    result.m_Final.assign(size, false);
+    result.m_Final[nfa.m_Initial + 1] = true;
+    result.m_Final[0] = nfa.m_Final[nfa.m_Initial];
+    result.m_Initial = 0;
+    return result;
+}
+
+/** The reversed automat, its new initial state goes where the final states were entered from */
+NFA reverse(const NFA& nfa) {
+    const State initial = nfa.m_States.empty() ? 0 : *nfa.m_States.rbegin() + 1;
+
+    NFA result{nfa.m_States, nfa.m_Alphabet, {}, initial, {nfa.m_InitialState}};
+    result.m_States.insert(initial);
+    if (nfa.m_FinalStates.count(nfa.m_InitialState) != 0)
+        result.m_FinalStates.insert(initial);
+
+    for (const auto& [config, targets] : nfa.m_Transitions) {
+        const auto& [source, symbol] = config;
+        for (const State target : targets) {
+            result.m_Transitions[{target, symbol}].insert(source);
+            if (nfa.m_FinalStates.count(target) != 0)
+                result.m_Transitions[{initial, symbol}].insert(source);
+        }
+    }
+    return result;
+}
+
+NFA reverse(const DFA& dfa) {
+    return reverse(dfaToNFA(dfa));
+}
+
+/** Both the automates side by side, the new initial state (named 0) starts both of them */
+NFATable nfaUnion(const NFATable& nfa1, const NFATable& nfa2) {
+    const size_t width = nfa1.width();
+    const State shift1 = 1;
+    const State shift2 = 1 + nfa1.size();
+
+    NFATable result(nfa1.m_Alphabet);
+    const auto append = [&](const NFATable& nfa, const State state, const Column column, const State shift) {
+        for (const State* target = nfa.targetsBegin(state, column); target != nfa.targetsEnd(state, column); ++target)
+            result.m_Targets.emplace_back(*target + shift);
+    };
+
+    result.m_Offsets.emplace_back(0);
+    for (Column column = 0; column < width; ++column) {
+        append(nfa1, nfa1.m_Initial, column, shift1);
+        append(nfa2, nfa2.m_Initial, column, shift2);
+        result.m_Offsets.emplace_back(result.m_Targets.size());
+    }
+    result.m_Final.push_back(nfa1.isFinal(nfa1.m_Initial) || nfa2.isFinal(nfa2.m_Initial));
+
+    for (const auto& [nfa, shift] : {make_pair(&nfa1, shift1), make_pair(&nfa2, shift2)}) {
+        for (State state = 0; state < nfa -> size(); ++state) {
+            for (Column column = 0; column < width; ++column) {
+                append(*nfa, state, column, shift);
+                result.m_Offsets.emplace_back(result.m_Targets.size());
+            }
+            result.m_Final.push_back(nfa -> isFinal(state));
+        }
+    }
+
+    result.m_Initial = 0;
+    return result;
+}
+
+/** Product accepting the intersection, only the reachable pairs, named in the BFS order */
+NFATable nfaProduct(const NFATable& nfa1, const NFATable& nfa2) {
+    const size_t width = nfa1.width();
+
+    NFATable result(nfa1.m_Alphabet);
+    unordered_map<uint64_t, State> names;
+    vector<DoubleState> order;
+
+    const auto discover = [&](const DoubleState& state) -> State {
+        const auto [itr, inserted] = names.emplace(parallelRunKey(state), order.size());
+        if (inserted) {
+            order.emplace_back(state);
+            result.m_Final.push_back(nfa1.isFinal(state.first) && nfa2.isFinal(state.second));
+        }
+        return itr -> second;
+    };
+
+    discover({nfa1.m_Initial, nfa2.m_Initial});
+    result.m_Offsets.emplace_back(0);
+
+    for (State current = 0; current < order.size(); ++current) {
+        const auto [state1, state2] = order[current];
+        for (Column column = 0; column < width; ++column) {
+            for (const State* target1 = nfa1.targetsBegin(state1, column); target1 != nfa1.targetsEnd(state1, column); ++target1)
+                for (const State* target2 = nfa2.targetsBegin(state2, column); target2 != nfa2.targetsEnd(state2, column); ++target2)
+                    result.m_Targets.emplace_back(discover({*target1, *target2}));
+            result.m_Offsets.emplace_back(result.m_Targets.size());
+        }
+    }
+
+    result.m_Initial = 0;
+    return result;
+}
+
+/**
+ * Brzozowski's minimization, the determinized reverse of a reachable
+ * automat is minimal, so doing that twice gives the minimal automat.
+ * The second subset construction starts from the final states themselves,
+ * the added initial state would stay as an extra copy of that subset. */
+Table brzozowski(const NFATable& nfa, const Options& options = {}) {
+    const Table backward = determinize(nfaReverse(nfa), options);
+    const NFATable reversed = nfaReverse(nfaFromTable(backward));
+
+    vector<State> finals;
+    for (State state = 0; state < backward.size(); ++state)
+        if (backward.isFinal(state))
+            finals.emplace_back(state + 1);
+
+    LazyTable lazy(reversed, finals, options);
+    for (State current = 0; current < lazy.size(); ++current)
+        lazy.expand(current);
+    return move(lazy.m_Table);
+}
+
+Table minimizeBrzozowski(const Table& table, const Options& options) {
+    return brzozowski(nfaFromTable(table), options);
+}
+
+/** Expands the subsets in the BFS order until there are limit of them, returns their count */
+size_t sampleSubsets(const NFATable& nfa, const size_t limit) {
+    LazyTable lazy(nfa);
+    for (State current = 0; current < lazy.size() && lazy.size() < limit; ++current)
+        lazy.expand(current);
+    return min(lazy.size(), limit);
+}
+
+/** Average number of targets of the non-empty transitions */
+double nondeterminism(const NFATable& nfa) {
+    size_t transitions = 0;
+    for (size_t i = 0; i + 1 < nfa.m_Offsets.size(); ++i)
+        transitions += nfa.m_Offsets[i] != nfa.m_Offsets[i + 1];
+    return transitions == 0 ? 1 : (double) nfa.m_Targets.size() / transitions;
+}
+
+/**
+ * Picks the pipeline for a binary operation unless options force one.
+ * Deterministic operands go through the subsets. Otherwise both the operands
+ * and their reverses are partially determinized, Brzozowski is chosen
+ * if the forward subsets outgrow the limit and the reversed ones do not.
+ * The decision is recorded into the statistics. */
+Pipeline selectPipeline(const NFATable& table1, const NFATable& table2, const Options& options) {
+    SelectorDecision decision;
+    decision.m_Pipeline = options.m_Pipeline;
+    decision.m_Forced = options.m_Pipeline != Pipeline::Auto;
+
+    if (!decision.m_Forced) {
+        decision.m_Pipeline = Pipeline::Subsets;
+        decision.m_Nondeterminism = max(nondeterminism(table1), nondeterminism(table2));
+
+        if (decision.m_Nondeterminism > 1) {
+            const NFATable reversed1 = nfaReverse(table1);
+            const NFATable reversed2 = nfaReverse(table2);
+            decision.m_ReverseNondeterminism = max(nondeterminism(reversed1), nondeterminism(reversed2));
+
+            // the samples may grow a few times over the operands
+            const size_t limit1 = 4 * table1.size() + 16;
+            const size_t limit2 = 4 * table2.size() + 16;
+            decision.m_SampleLimit = limit1 + limit2;
+            decision.m_ForwardSubsets = sampleSubsets(table1, limit1) + sampleSubsets(table2, limit2);
+            decision.m_ReverseSubsets = sampleSubsets(reversed1, limit1) + sampleSubsets(reversed2, limit2);
+
+            if (decision.m_ForwardSubsets == decision.m_SampleLimit && decision.m_ReverseSubsets < decision.m_SampleLimit)
+                decision.m_Pipeline = Pipeline::Brzozowski;
+        }
+    }
+
+    if (options.m_Statistics != nullptr)
+        options.m_Statistics -> m_Decisions.emplace_back(decision);
+    return decision.m_Pipeline;
+}
+
+
+// --- Operand cache ----------------------------------------------------------
+
+#ifndef __PROGTEST__
+/** Passes the whole structure of the automat to emit, value by value */
+template<typename Emit>
+void nfaStructure(const NFA& nfa, const Emit& mix) {
+    mix(nfa.m_States.size());
+    for (const State state : nfa.m_States) mix(state);
+    mix(nfa.m_Alphabet.size());
+    for (const Symbol symbol : nfa.m_Alphabet) mix(symbol);
+
+    mix(nfa.m_Transitions.size());
+    for (const auto& [config, targets] : nfa.m_Transitions) {
+        mix(config.first);
+        mix(config.second);
+        mix(targets.size());
+        for (const State target : targets) mix(target);
+    }
+
+    mix(nfa.m_InitialState);
+    mix(nfa.m_FinalStates.size());
+    for (const State state : nfa.m_FinalStates) mix(state);
+}
+
+/** Structural hash of the automat, the same automates always get the same one */
+uint64_t nfaFingerprint(const NFA& nfa) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    nfaStructure(nfa, [&](const uint64_t value) {
+        hash = (hash ^ value) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    });
+    return hash;
+}
+
+/** The structure as bytes, unlike the fingerprint it is equal for the same automates only */
+string nfaKey(const NFA& nfa) {
+    string key;
+    nfaStructure(nfa, [&](const uint64_t value) { key.append((const char*) &value, sizeof(value)); });
+    return key;
+}
+
+const uint32_t tableMagic = 0x54474141;    // "AAGT"
+
+/** Writes the table in a native endian binary form */
+void tableWrite(ostream& out, const Table& table) {
+    const uint32_t width = table.width();
+    const uint64_t size = table.size();
+    const vector<uint8_t> final(table.m_Final.begin(), table.m_Final.end());
+
+    out.write((const char*) &tableMagic, sizeof(tableMagic));
+    out.write((const char*) &width, sizeof(width));
+    out.write((const char*) table.m_Alphabet.data(), width * sizeof(Symbol));
+    out.write((const char*) &size, sizeof(size));
+    out.write((const char*) &table.m_Initial, sizeof(table.m_Initial));
+    out.write((const char*) table.m_Transitions.data(), table.m_Transitions.size() * sizeof(State));
+    out.write((const char*) final.data(), final.size());
+}
+
+/** Reads a table written by tableWrite, nullopt if the input is not one */
+optional<Table> tableRead(istream& in) {
+    uint32_t magic = 0, width = 0;
+    uint64_t size = 0;
+    in.read((char*) &magic, sizeof(magic));
+    in.read((char*) &width, sizeof(width));
+    if (!in || magic != tableMagic || width > 256) return nullopt;
+
+    vector<Symbol> alphabet(width);
+    in.read((char*) alphabet.data(), width * sizeof(Symbol));
+    Table table(alphabet);
+
+    in.read((char*) &size, sizeof(size));
+    in.read((char*) &table.m_Initial, sizeof(table.m_Initial));
+    if (!in || size == 0 || table.m_Initial >= size) return nullopt;
+
+    table.m_Transitions.resize(size * width);
+    in.read((char*) table.m_Transitions.data(), table.m_Transitions.size() * sizeof(State));
+    vector<uint8_t> final(size);
+    in.read((char*) final.data(), final.size());
+    if (!in) return nullopt;
+
+    for (const State target : table.m_Transitions)
+        if (target != noState && target >= size) return nullopt;
+    table.m_Final.assign(final.begin(), final.end());
+    return table;
+}
+
+/**
+ * Least recently used cache of the determinized operands, found by the
+ * fingerprints and told apart by the whole nfaKey, so a colliding operand
+ * takes the place of the cached one. An operand is kept over its own
+ * alphabet, minimized if m_Minimize is set, so it fits any call. With
+ * m_Directory set the evicted and the missing ones are looked up in files
+ * there as well, the key is stored in front of the table.
+ * Safe to be shared by threads, an operand may be computed twice then. */
+struct OperandCache {
+    struct Entry {
+        uint64_t m_Fingerprint;
+        string m_Key;
+        shared_ptr<const Table> m_Table;
+    };
+
+    size_t m_Capacity;
+    string m_Directory;
+    bool m_Minimize = true;
+
+    size_t m_Hits = 0;
+    size_t m_DiskHits = 0;
+    size_t m_Misses = 0;
+    size_t m_Evictions = 0;
+
+    list<Entry> m_Entries;  // the most recent first
+    unordered_map<uint64_t, list<Entry>::iterator> m_Index;
+    mutex m_Lock;
+    atomic<size_t> m_Writes{0};
+
+    explicit OperandCache(const size_t capacity, const string& directory = "")
+        : m_Capacity(capacity), m_Directory(directory) {}
+
+    string path(const uint64_t fingerprint) const {
+        ostringstream name;
+        name << m_Directory << '/' << hex << setw(16) << setfill('0') << fingerprint << ".dfa";
+        return name.str();
+    }
+
+    shared_ptr<const Table> readEntry(const uint64_t fingerprint, const string& key) const {
+        ifstream in(path(fingerprint), ios::binary);
+        uint64_t length = 0;
+        in.read((char*) &length, sizeof(length));
+        if (!in || length != key.size()) return nullptr;
+
+        string stored(length, '\0');
+        in.read(stored.data(), length);
+        if (!in || stored != key) return nullptr;
+
+        optional<Table> table = tableRead(in);
+        return table ? make_shared<const Table>(move(*table)) : nullptr;
+    }
+
+    /** Writes a temporary file first and renames it, so the readers never see a part of it */
+    void writeEntry(const uint64_t fingerprint, const string& key, const Table& table) {
+        const string target = path(fingerprint);
+        const string temporary = target + "." + to_string(getpid()) + "." + to_string(m_Writes++) + ".tmp";
+        {
+            ofstream out(temporary, ios::binary);
+            const uint64_t length = key.size();
+            out.write((const char*) &length, sizeof(length));
+            out.write(key.data(), key.size());
+            tableWrite(out, table);
+            if (!out) {
+                out.close();
+                remove(temporary.c_str());
+                return;
+            }
+        }
+        if (rename(temporary.c_str(), target.c_str()) != 0)
+            remove(temporary.c_str());
+    }
+
+    /** Returns the determinized operand, computes it on a miss */
+    shared_ptr<const Table> operand(const NFA& nfa, const Options& options) {
+        const uint64_t fingerprint = nfaFingerprint(nfa) ^ m_Minimize;
+        const string key = nfaKey(nfa) + (char) m_Minimize;
+        {
+            lock_guard<mutex> lock(m_Lock);
+            const auto itr = m_Index.find(fingerprint);
+            if (itr != m_Index.end() && itr -> second -> m_Key == key) {
+                ++m_Hits;
+                m_Entries.splice(m_Entries.begin(), m_Entries, itr -> second);
+                return itr -> second -> m_Table;
+            }
+        }
+
+        shared_ptr<const Table> table;
+        if (!m_Directory.empty())
+            table = readEntry(fingerprint, key);
+
+        bool fromDisk = table != nullptr;
+        if (!fromDisk) {
+            Options plain = options;
+            plain.m_Statistics = nullptr;
+            plain.m_Cache = nullptr;
+
+            const NFATable compiled = nfaTrim(nfaCompile(nfa, nfa.m_Alphabet));
+            shared_ptr<const Simulation> simulation;
+            const NFATable reduced = nfaReduce(compiled, options.m_Reduction, &simulation);
+            Table dfa = determinize(reduced, plain, nullptr, simulation);
+            if (m_Minimize)
+                dfa = minimize(dfa, plain);
+            table = make_shared<const Table>(move(dfa));
+
+            if (!m_Directory.empty())
+                writeEntry(fingerprint, key, *table);
+        }
+
+        lock_guard<mutex> lock(m_Lock);
+        ++(fromDisk ? m_DiskHits : m_Misses);
+        const auto itr = m_Index.find(fingerprint);
+        if (itr != m_Index.end() && itr -> second -> m_Key != key) {
+            m_Entries.erase(itr -> second);
+            m_Index.erase(itr);
+        }
+        if (m_Index.count(fingerprint) == 0) {
+            m_Entries.push_front({fingerprint, key, table});
+            m_Index.emplace(fingerprint, m_Entries.begin());
+        }
+        while (m_Entries.size() > m_Capacity) {
+            m_Index.erase(m_Entries.back().m_Fingerprint);
+            m_Entries.pop_back();
+            ++m_Evictions;
+        }
+        return table;
+    }
+};
+
+/** Places the table over a wider alphabet, the new columns have no transitions */
+Table tableExtend(const Table& table, const set<Symbol>& alphabet) {
+    Table result(alphabet);
+    result.m_Transitions.assign(table.size() * result.width(), noState);
+    result.m_Final = table.m_Final;
+    result.m_Initial = table.m_Initial;
+
+    for (State state = 0; state < table.size(); ++state)
+        for (Column column = 0; column < table.width(); ++column)
+            result.row(state)[result.m_Columns[table.m_Alphabet[column]]] = table.row(state)[column];
+    return result;
+}
+#endif
+
+/** Compiles the operand over the alphabet, through the cache if the options have one */
+NFATable compileOperand(const NFA& nfa, const set<Symbol>& alphabet, [[maybe_unused]] const Options& options) {
+#ifndef __PROGTEST__
+    if (options.m_Cache != nullptr)
+        return nfaFromTable(tableExtend(*options.m_Cache -> operand(nfa, options), alphabet));
+#endif
+    return nfaCompile(nfa, alphabet);
+}
+
+
+/**
+ * Runs the pipeline over the compiled automates, returns the minimal automat.
+ * The simulations are the ones nfaReduce has left for the tables, if any. */
+Table handleProgtestTables(const NFATable& table1, const NFATable& table2, const bool isIntersect, const Options& options,
+        const shared_ptr<const Simulation>& simulation1 = nullptr, const shared_ptr<const Simulation>& simulation2 = nullptr) {
+    Statistics* statistics = options.m_Statistics;
+
+    if (selectPipeline(table1, table2, options) == Pipeline::Brzozowski) {
+        const NFATable operation = statisticsStage(statistics, isIntersect ? "nfaProduct" : "nfaUnion",
+                [&](StageStatistics*) { return isIntersect ? nfaProduct(table1, table2) : nfaUnion(table1, table2); });
+        return statisticsStage(statistics, "brzozowski",
+                [&](StageStatistics*) { return brzozowski(operation, options); });
+    }
+
+    if (options.m_Lazy) {
+        // the operands are determinized within the product stage
+        LazyTable dfa1(table1, options, simulation1);
+        LazyTable dfa2(table2, options, simulation2);
+        const Table product = statisticsStage(statistics, "parallelRun",
+                [&](StageStatistics* stage) { return parallelRun(dfa1, dfa2, isIntersect, stage); });
+        statisticsSize(statistics, "lazyDeterminize1", dfa1.m_Table);
+        statisticsSize(statistics, "lazyDeterminize2", dfa2.m_Table);
+        return minimize(product, options);
+    }
+
+    const Table dfa1 = statisticsStage(statistics, "determinize1",
+            [&](StageStatistics* stage) { return determinize(table1, options, stage, simulation1); });
+    const Table dfa2 = statisticsStage(statistics, "determinize2",
+            [&](StageStatistics* stage) { return determinize(table2, options, stage, simulation2); });
+    // the operands stay partial, the product handles the missing transitions
+    const Table product = statisticsStage(statistics, "parallelRun", [&](StageStatistics* stage) {
+#ifdef HAS_THREADS
+        if (options.m_Threads > 1)
+            return parallelRunConcurrent(dfa1, dfa2, isIntersect, options.m_Threads);
+#endif
+        return parallelRun(dfa1, dfa2, isIntersect, stage);
+    });
+    return minimize(product, options);
+}
+
+/** The pipeline from the operands compiled over the common alphabet to the result */
+DFA handleProgtestCompiled(NFATable table1, NFATable table2, const set<Symbol>& alphabet,
+        const bool isIntersect, const Options& options) {
+    if (options.m_Trim) {
+        table1 = statisticsStage(options.m_Statistics, "trim1", [&](StageStatistics*) { return nfaTrim(table1); });
+        table2 = statisticsStage(options.m_Statistics, "trim2", [&](StageStatistics*) { return nfaTrim(table2); });
+    }
+    shared_ptr<const Simulation> simulation1, simulation2;
+    if (options.m_Reduction != Reduction::None) {
+        table1 = statisticsStage(options.m_Statistics, "reduce1",
+                [&](StageStatistics*) { return nfaReduce(table1, options.m_Reduction, &simulation1); });
+        table2 = statisticsStage(options.m_Statistics, "reduce2",
+                [&](StageStatistics*) { return nfaReduce(table2, options.m_Reduction, &simulation2); });
+    }
+
+    optional<SymbolClasses> classes;
+    if (options.m_CompressAlphabet) {
+        classes = symbolClasses({&table1, &table2}, table1.m_Alphabet);
+        table1 = compressColumns(table1, *classes);
+        table2 = compressColumns(table2, *classes);
+    }
+
+    Table minimal = handleProgtestTables(table1, table2, isIntersect, options, simulation1, simulation2);
+    if (classes)
+        minimal = expandColumns(minimal, vector<Symbol>(alphabet.begin(), alphabet.end()), *classes);
+    return tableToDFA(tableRename(minimal));
+}
+
+DFA handleProgtest(const NFA& nfa1, const NFA& nfa2, const bool isIntersect, const Options& options = {}) {
+    const set<Symbol> alphabet = commonAlphabet<NFA>(nfa1, nfa2);
+
+    NFATable table1 = statisticsStage(options.m_Statistics, "compile1",
+            [&](StageStatistics*) { return compileOperand(nfa1, alphabet, options); });
+    NFATable table2 = statisticsStage(options.m_Statistics, "compile2",
+            [&](StageStatistics*) { return compileOperand(nfa2, alphabet, options); });
+    return handleProgtestCompiled(move(table1), move(table2), alphabet, isIntersect, options);
+}
+
+DFA unify    (const NFA& a, const NFA& b) { return handleProgtest(a, b, false); }
+DFA intersect(const NFA& a, const NFA& b) { return handleProgtest(a, b, true ); }
+
+DFA unify    (const NFA& a, const NFA& b, const Options& options) { return handleProgtest(a, b, false, options); }
+DFA intersect(const NFA& a, const NFA& b, const Options& options) { return handleProgtest(a, b, true,  options); }
+
+// --- N-ary operations -------------------------------------------------------
+
+/**
+ * Performs the parallel run over all the automates at once, product states
+ * are tuples of the operand states interned in a pool. Dead components are
+ * replaced by the sink, the tuples that are universal as a whole (for union)
+ * are collapsed into a single product state, the dead ones are left out.
+ * States are named in the BFS order. */
+Table parallelRunTuples(
+        vector<LazyTable<>>& dfas,
+        const vector<Symbol>& alphabet,
+        const bool isIntersect,
+        StageStatistics* stage = nullptr
+        ) {
+    const size_t width = alphabet.size();
+    const size_t count = dfas.size();
+
+    Table result(alphabet);
+    SubsetPool tuples;
+
+    const auto discover = [&](vector<State>& tuple) -> State {
+        bool anyDead = false, allDead = true, anyUniversal = false;
+        for (size_t i = 0; i < count; ++i) {
+            State& state = tuple[i];
+            if (state == universalState) {
+                anyUniversal = true;
+                allDead = false;
+                continue;
+            }
+
+            if (state != noState && dfas[i].m_Kinds[state] == StateKind::Dead)
+                state = noState;
+            if (state == noState) {
+                anyDead = true;
+                continue;
+            }
+
+            allDead = false;
+            if (dfas[i].m_Kinds[state] == StateKind::Universal)
+                anyUniversal = true;
+        }
+
+        if (isIntersect ? anyDead : allDead) {
+            // the dead tuple is not materialized past the initial one
+            if (tuples.size() != 0) return noState;
+            fill(tuple.begin(), tuple.end(), noState);
+        } else if (!isIntersect && anyUniversal)
+            fill(tuple.begin(), tuple.end(), universalState);
+
+        const auto [name, inserted] = tuples.intern(tuple.data(), tuple.data() + count);
+        if (inserted) {
+            bool isFinal = isIntersect;
+            for (size_t i = 0; i < count; ++i) {
+                const State state = tuple[i];
+                const bool fin = state == universalState || (state != noState && dfas[i].isFinal(state));
+                isFinal = isIntersect ? isFinal && fin : isFinal || fin;
+            }
+            result.addState(isFinal);
+        }
+        return name;
+    };
+
+    vector<State> tuple(count);
+    for (size_t i = 0; i < count; ++i)
+        tuple[i] = dfas[i].m_Initial;
+    discover(tuple);
+
+    vector<State> source(count);
+    vector<const State*> rows(count);
+
+    // BFS, the tuples are named in the order they are discovered
+    for (State current = 0; current < tuples.size(); ++current) {
+        statisticsQueue(stage, tuples.size() - current);
+        copy(tuples.begin(current), tuples.end(current), source.begin());
+
+        if (count != 0 && source[0] == universalState) {
+            fill(result.row(current), result.row(current) + width, current);
+            continue;
+        }
+
+        // each operand is expanded at most once here, so the rows stay valid
+        for (size_t i = 0; i < count; ++i)
+            rows[i] = source[i] == noState ? nullptr : dfas[i].row(source[i]);
+
+        for (Column column = 0; column < width; ++column) {
+            for (size_t i = 0; i < count; ++i)
+                tuple[i] = rows[i] == nullptr ? noState : rows[i][column];
+
+            const State target = discover(tuple);
+            result.row(current)[column] = target;
+        }
+    }
+
+    result.m_Initial = 0;
+    return result;
+}
+
+/**
+ * Combines all the automates at once, the result is minimized only once.
+ * The operands may be minimized first if m_MinimizeOperands is set. */
+DFA handleMany(const vector<NFA>& nfas, const bool isIntersect, const Options& options) {
+    set<Symbol> alphabet;
+    for (const NFA& nfa : nfas)
+        alphabet.insert(nfa.m_Alphabet.begin(), nfa.m_Alphabet.end());
+
+    // the lazy tables keep references, so all the tables must be ready first
+    vector<NFATable> tables;
+    tables.reserve(nfas.size());
+    for (const NFA& nfa : nfas)
+        tables.emplace_back(compileOperand(nfa, alphabet, options));
+
+    if (options.m_Trim)
+        for (NFATable& table : tables)
+            table = nfaTrim(table);
+    vector<shared_ptr<const Simulation>> simulations(tables.size());
+    if (options.m_Reduction != Reduction::None)
+        for (size_t i = 0; i < tables.size(); ++i)
+            tables[i] = nfaReduce(tables[i], options.m_Reduction, &simulations[i]);
+
+    Columns columns(alphabet);
+    optional<SymbolClasses> classes;
+    if (options.m_CompressAlphabet) {
+        vector<const NFATable*> pointers;
+        for (const NFATable& table : tables)
+            pointers.emplace_back(&table);
+
+        classes = symbolClasses(pointers, columns.m_Alphabet);
+        for (NFATable& table : tables)
+            table = compressColumns(table, *classes);
+        columns = Columns(classes -> m_Representatives);
+    }
+
+    // the relations are over the states before the minimization
+    if (options.m_MinimizeOperands) {
+        for (size_t i = 0; i < tables.size(); ++i)
+            tables[i] = nfaFromTable(minimize(determinize(tables[i], options, nullptr, simulations[i]), options));
+        simulations.assign(tables.size(), nullptr);
+    }
+
+    vector<LazyTable<>> dfas;
+    dfas.reserve(tables.size());
+    for (size_t i = 0; i < tables.size(); ++i)
+        dfas.emplace_back(tables[i], options, simulations[i]);
+
+    const Table product = statisticsStage(options.m_Statistics, "parallelRun",
+            [&](StageStatistics* stage) { return parallelRunTuples(dfas, columns.m_Alphabet, isIntersect, stage); });
+
+    Table minimal = minimize(product, options);
+    if (classes)
+        minimal = expandColumns(minimal, vector<Symbol>(alphabet.begin(), alphabet.end()), *classes);
+    return tableToDFA(tableRename(minimal));
+}
+
+DFA unify    (const vector<NFA>& nfas, const Options& options = {}) { return handleMany(nfas, false, options); }
+DFA intersect(const vector<NFA>& nfas, const Options& options = {}) { return handleMany(nfas, true,  options); }
+
+// --- Batch ------------------------------------------------------------------
+
+#ifndef __PROGTEST__
+/** A single unify or intersect call, the operands must live until the batch is done */
+struct Job {
+    bool m_IsIntersect;
+    const NFA* m_First;
+    const NFA* m_Second;
+};
+
+/**
+ * Runs the jobs in parallel on options.m_Threads workers, started for the call
+ * by parallelChunks as in the other threaded stages. A worker takes a job at
+ * a time, so every job runs as the single call with one thread would. The results
+ * are in the order of the jobs. With shareOperands the operands go through
+ * an OperandCache (options.m_Cache if set), an automat used by several jobs
+ * is then determinized only once. Each worker records its stages into its
+ * own Statistics, they are appended to options.m_Statistics after the run.
+ * The allocations are counted per thread, so the jobs running at the same
+ * time do not show up in each other's stages. */
+vector<DFA> runBatch(const vector<Job>& jobs, const Options& options = {}, const bool shareOperands = false) {
+    const size_t workers = max(options.m_Threads, (size_t) 1);
+
+    Options single = options;
+    single.m_Threads = 1;
+
+    optional<OperandCache> cache;
+    if (shareOperands && single.m_Cache == nullptr) {
+        cache.emplace(2 * jobs.size());
+        single.m_Cache = &*cache;
+    }
+
+    vector<Statistics> statistics(workers);
+    vector<Options> local(workers, single);
+    if (options.m_Statistics != nullptr)
+        for (size_t worker = 0; worker < workers; ++worker)
+            local[worker].m_Statistics = &statistics[worker];
+
+    vector<DFA> results(jobs.size());
+    parallelChunks(workers, jobs.size(), 1, [&](const size_t worker, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            results[i] = handleProgtest(*jobs[i].m_First, *jobs[i].m_Second, jobs[i].m_IsIntersect, local[worker]);
+    });
+
+    if (options.m_Statistics != nullptr) {
+        for (Statistics& worker : statistics) {
+            vector<StageStatistics>& stages = options.m_Statistics -> m_Stages;
+            vector<SelectorDecision>& decisions = options.m_Statistics -> m_Decisions;
+            move(worker.m_Stages.begin(), worker.m_Stages.end(), back_inserter(stages));
+            move(worker.m_Decisions.begin(), worker.m_Decisions.end(), back_inserter(decisions));
+        }
+    }
+    return results;
+}
+#endif
+
+// --- Language queries -------------------------------------------------------
+
+/** Builds the word leading to the node given by following the parents */
+template<typename Node>
+vector<Symbol> queryWord(const vector<Node>& nodes, size_t node, const vector<Symbol>& alphabet) {
+    vector<Symbol> word;
+    for (; nodes[node].m_Parent != noState; node = nodes[node].m_Parent)
+        word.emplace_back(alphabet[nodes[node].m_Column]);
+    reverse(word.begin(), word.end());
+    return word;
+}
+
+/**
+ * Checks if no word is accepted by both the automates. Runs BFS over
+ * the pairs of the NFA states, so no determinization is needed.
+ * A shortest word accepted by both is stored into witness if there is one. */
+bool isIntersectionEmpty(const NFA& nfa1, const NFA& nfa2, vector<Symbol>* witness = nullptr) {
+    const set<Symbol> alphabet = commonAlphabet<NFA>(nfa1, nfa2);
+    const NFATable table1 = nfaCompile(nfa1, alphabet);
+    const NFATable table2 = nfaCompile(nfa2, alphabet);
+    const size_t width = table1.width();
+
+    struct Node { DoubleState m_State; State m_Parent; Column m_Column; };
+    vector<Node> nodes = {{{table1.m_Initial, table2.m_Initial}, noState, 0}};
+    unordered_map<uint64_t, State> visited = {{parallelRunKey(nodes[0].m_State), 0}};
+
+    // BFS, nodes work as the queue
+    for (State current = 0; current < nodes.size(); ++current) {
+        const auto [state1, state2] = nodes[current].m_State;
+
+        if (table1.isFinal(state1) && table2.isFinal(state2)) {
+            if (witness != nullptr)
+                *witness = queryWord(nodes, current, table1.m_Alphabet);
+            return false;
+        }
+
+        for (Column column = 0; column < width; ++column) {
+            for (const State* itr1 = table1.targetsBegin(state1, column); itr1 != table1.targetsEnd(state1, column); ++itr1) {
+                for (const State* itr2 = table2.targetsBegin(state2, column); itr2 != table2.targetsEnd(state2, column); ++itr2) {
+                    const DoubleState target = {*itr1, *itr2};
+                    if (visited.emplace(parallelRunKey(target), nodes.size()).second)
+                        nodes.push_back({target, current, column});
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks if L(nfa1) is a subset of L(nfa2). Explores the pairs of a nfa1 state
+ * and a subset of the nfa2 states, the second automat is determinized on the fly.
+ * Keeps only an antichain: a pair is skipped if a pair with the same state
+ * and a smaller subset has been already seen. A shortest word accepted
+ * by nfa1 but not by nfa2 is stored into counterexample if there is one. */
+bool isIncluded(const NFA& nfa1, const NFA& nfa2, vector<Symbol>* counterexample = nullptr) {
+    const set<Symbol> alphabet = commonAlphabet<NFA>(nfa1, nfa2);
+    const NFATable table1 = nfaCompile(nfa1, alphabet);
+    const NFATable table2 = nfaCompile(nfa2, alphabet);
+    const size_t width = table1.width();
+
+    // dead nfa1 states cannot lead to a counterexample, neither universal nfa2 states
+    const vector<StateKind> kinds1 = nfaKinds(table1);
+    const vector<StateKind> kinds2 = nfaKinds(table2);
+
+    struct Node { State m_State; State m_Subset; State m_Parent; Column m_Column; };
+    SubsetPool subsets;
+    vector<vector<State>> antichain(table1.size());
+    vector<Node> nodes;
+
+    const auto discover = [&](const State state, const vector<State>& subset, const State parent, const Column column) {
+        if (kinds1[state] == StateKind::Dead) return;
+        for (const State member : subset)
+            if (kinds2[member] == StateKind::Universal) return;
+
+        // skip the pair if it is subsumed, drop the pairs it subsumes
+        vector<State>& chain = antichain[state];
+        for (const State other : chain)
+            if (includes(subset.begin(), subset.end(), subsets.begin(other), subsets.end(other)))
+                return;
+
+        const State name = subsets.intern(subset.data(), subset.data() + subset.size()).first;
+        chain.erase(remove_if(chain.begin(), chain.end(), [&](const State other) {
+            return includes(subsets.begin(other), subsets.end(other), subset.begin(), subset.end());
+        }), chain.end());
+        chain.emplace_back(name);
+
+        nodes.push_back({state, name, parent, column});
+    };
+
+    discover(table1.m_Initial, {table2.m_Initial}, noState, 0);
+
+    // holds the nfa2 subset we get to for the column given
+    vector<vector<State>> results(width);
+
+    // BFS, nodes work as the queue
+    for (State current = 0; current < nodes.size(); ++current) {
+        const State state = nodes[current].m_State;
+        const State subset = nodes[current].m_Subset;
+
+        if (table1.isFinal(state) && none_of(subsets.begin(subset), subsets.end(subset),
+                    [&](const State member) { return table2.isFinal(member); })) {
+            if (counterexample != nullptr)
+                *counterexample = queryWord(nodes, current, table1.m_Alphabet);
+            return false;
+        }
+
+        determinizeSuccessors(table2, subsets.begin(subset), subsets.end(subset), results);
+
+        for (Column column = 0; column < width; ++column) {
+            for (const State* itr = table1.targetsBegin(state, column); itr != table1.targetsEnd(state, column); ++itr)
+                discover(*itr, results[column], current, column);
+            results[column].clear();
+        }
+    }
+    return true;
+}
+
+/**
+ * Hopcroft-Karp check of the language equivalence. Merges the pairs of states
+ * that must be equivalent by union-find, the automates are equivalent unless
+ * a final and a non-final state get merged. Missing transitions lead to a
+ * sink shared by both the automates. A shortest distinguishing word is stored
+ * into word if the automates differ. */
+template<typename Operand>
+bool equivalentRun(Operand& dfa1, Operand& dfa2, vector<Symbol>* word) {
+    const size_t width = dfa1.width();
+
+    // elements are 0 for the sink and 1 + 2 * state + side otherwise
+    vector<size_t> parents;
+    const auto element = [&](const State state, const size_t side) -> size_t {
+        const size_t result = state == noState ? 0 : 1 + 2 * (size_t) state + side;
+        while (parents.size() <= result)
+            parents.emplace_back(parents.size());
+        return result;
+    };
+    const auto root = [&](size_t item) {
+        while (parents[item] != item) {
+            parents[item] = parents[parents[item]];
+            item = parents[item];
+        }
+        return item;
+    };
+
+    struct Node { DoubleState m_State; State m_Parent; Column m_Column; };
+    vector<Node> nodes = {{{dfa1.m_Initial, dfa2.m_Initial}, noState, 0}};
+    parents[root(element(dfa2.m_Initial, 1))] = root(element(dfa1.m_Initial, 0));
+
+    // BFS, nodes work as the queue
+    for (State current = 0; current < nodes.size(); ++current) {
+        const auto [state1, state2] = nodes[current].m_State;
+        const bool fin1 = state1 != noState && dfa1.isFinal(state1);
+        const bool fin2 = state2 != noState && dfa2.isFinal(state2);
+
+        if (fin1 != fin2) {
+            if (word != nullptr)
+                *word = queryWord(nodes, current, dfa1.m_Alphabet);
+            return false;
+        }
+
+        for (Column column = 0; column < width; ++column) {
+            // the rows are valid only until the next expansion
+            const State target1 = state1 == noState ? noState : dfa1.row(state1)[column];
+            const State target2 = state2 == noState ? noState : dfa2.row(state2)[column];
+
+            const size_t root1 = root(element(target1, 0));
+            const size_t root2 = root(element(target2, 1));
+            if (root1 != root2) {
+                parents[root2] = root1;
+                nodes.push_back({{target1, target2}, current, column});
+            }
+        }
+    }
+    return true;
+}
+
+/** Checks if both the automates accept the same language, see equivalentRun */
+bool equivalent(const DFA& dfa1, const DFA& dfa2, vector<Symbol>* word = nullptr) {
+    const set<Symbol> alphabet = commonAlphabet<DFA>(dfa1, dfa2);
+    const Table table1 = tableFromDFA(dfa1, alphabet);
+    const Table table2 = tableFromDFA(dfa2, alphabet);
+    return equivalentRun(table1, table2, word);
+}
+
+/** Checks if both the automates accept the same language, determinizes them on the fly */
+bool equivalent(const NFA& nfa1, const NFA& nfa2, vector<Symbol>* word = nullptr) {
+    const set<Symbol> alphabet = commonAlphabet<NFA>(nfa1, nfa2);
+    const NFATable table1 = nfaCompile(nfa1, alphabet);
+    const NFATable table2 = nfaCompile(nfa2, alphabet);
+    LazyTable dfa1(table1);
+    LazyTable dfa2(table2);
+    return equivalentRun(dfa1, dfa2, word);
+}
+
+// --- ALT format -------------------------------------------------------------
+
+#ifndef __PROGTEST__
+/**
+ * Parser of the ALT text form of the automates, for example
+ * NFA(states = {0, 1}, inputAlphabet = {a, b}, initialState = 0, finalStates = {1}, transitions = {(0, a, 1)})
+ * It walks the buffer once and builds the automat directly, no token is copied.
+ * The fields may come in any order. On a failure m_Error points where the input went wrong. */
+struct AltParser {
+    const char* m_Current;
+    const char* m_End;
+    const char* m_Error = nullptr;
+
+    AltParser(const char* begin, const char* end) : m_Current(begin), m_End(end) {}
+
+    bool fail() {
+        if (m_Error == nullptr) m_Error = m_Current;
+        return false;
+    }
+
+    void skip() {
+        while (m_Current != m_End && isspace((unsigned char) *m_Current))
+            ++m_Current;
+    }
+
+    bool accept(const char c) {
+        skip();
+        if (m_Current == m_End || *m_Current != c) return false;
+        ++m_Current;
+        return true;
+    }
+
+    bool expect(const char c) { return accept(c) || fail(); }
+
+    bool atEnd() {
+        skip();
+        return m_Current == m_End;
+    }
+
+    string_view word() {
+        skip();
+        const char* begin = m_Current;
+        while (m_Current != m_End && isalpha((unsigned char) *m_Current))
+            ++m_Current;
+        return string_view(begin, m_Current - begin);
+    }
+
+    bool number(State& value) {
+        skip();
+        if (m_Current == m_End || !isdigit((unsigned char) *m_Current)) return fail();
+
+        uint64_t result = 0;
+        for (; m_Current != m_End && isdigit((unsigned char) *m_Current); ++m_Current) {
+            result = result * 10 + (*m_Current - '0');
+            if (result >= noState - 1) return fail();
+        }
+        value = result;
+        return true;
+    }
+
+    /** A single character, optionally quoted */
+    bool symbol(Symbol& value) {
+        const bool quoted = accept('\'');
+        if (!quoted) skip();
+        if (m_Current == m_End || (!quoted && strchr(",(){}= ", *m_Current) != nullptr)) return fail();
+
+        value = *m_Current++;
+        return !quoted || expect('\'');
+    }
+
+    /** Parses {item, ...}, the list may be empty */
+    template<typename Item>
+    bool list(const Item& item) {
+        if (!expect('{')) return false;
+        if (accept('}')) return true;
+        do {
+            if (!item()) return false;
+        } while (accept(','));
+        return expect('}');
+    }
+
+    /** Parses an automat, nullopt if the input is not a valid one */
+    optional<NFA> automaton() {
+        const string_view kind = word();
+        if ((kind != "NFA" && kind != "DFA") || !expect('(')) return fail(), nullopt;
+
+        NFA nfa;
+        bool hasInitial = false;
+        do {
+            const string_view field = word();
+            if (!expect('=')) return nullopt;
+
+            bool parsed;
+            if (field == "states") {
+                parsed = list([&]() {
+                    State state;
+                    return number(state) && (nfa.m_States.emplace_hint(nfa.m_States.end(), state), true);
+                });
+            } else if (field == "inputAlphabet") {
+                parsed = list([&]() {
+                    Symbol symbol;
+                    return this -> symbol(symbol) && (nfa.m_Alphabet.insert(symbol), true);
+                });
+            } else if (field == "initialState") {
+                parsed = hasInitial = number(nfa.m_InitialState);
+            } else if (field == "finalStates") {
+                parsed = list([&]() {
+                    State state;
+                    return number(state) && (nfa.m_FinalStates.emplace_hint(nfa.m_FinalStates.end(), state), true);
+                });
+            } else if (field == "transitions") {
+                parsed = list([&]() {
+                    State source, target;
+                    Symbol symbol;
+                    if (!expect('(') || !number(source) || !expect(',') || !this -> symbol(symbol)
+                            || !expect(',') || !number(target) || !expect(')'))
+                        return false;
+                    nfa.m_Transitions[{source, symbol}].insert(target);
+                    return true;
+                });
+            } else {
+                parsed = fail();
+            }
+            if (!parsed) return nullopt;
+        } while (accept(','));
+        if (!expect(')')) return nullopt;
+
+        // the states and symbols used must be declared
+        bool valid = hasInitial && nfa.m_States.count(nfa.m_InitialState) != 0
+                && includes(nfa.m_States.begin(), nfa.m_States.end(), nfa.m_FinalStates.begin(), nfa.m_FinalStates.end());
+        for (const auto& [config, targets] : nfa.m_Transitions) {
+            valid = valid && nfa.m_States.count(config.first) != 0 && nfa.m_Alphabet.count(config.second) != 0;
+            for (const State target : targets)
+                valid = valid && nfa.m_States.count(target) != 0;
+        }
+        if (!valid) return fail(), nullopt;
+
+        return nfa;
+    }
+};
+
+/** Parses a single automat taking the whole buffer */
+optional<NFA> parseALT(const char* begin, const char* end, const char** error = nullptr) {
+    AltParser parser(begin, end);
+    optional<NFA> result = parser.automaton();
+    if (result && !parser.atEnd()) {
+        parser.fail();
+        result.reset();
+    }
+    if (error != nullptr) *error = parser.m_Error;
+    return result;
+}
+
+optional<NFA> parseALT(const string& text, const char** error = nullptr) {
+    return parseALT(text.data(), text.data() + text.size(), error);
+}
+
+/** Writes the automat in the ALT text form, the symbols other than letters and digits are quoted */
+void writeALT(ostream& out, const DFA& dfa) {
+    const auto join = [&](const auto& items, const auto& print) {
+        out << '{';
+        bool first = true;
+        for (const auto& item : items) {
+            if (!first) out << ", ";
+            print(item);
+            first = false;
+        }
+        out << '}';
+    };
+    const auto state = [&](const State state) { out << state; };
+    const auto symbol = [&](const Symbol symbol) {
+        if (isalnum(symbol)) out << (char) symbol;
+        else out << '\'' << (char) symbol << '\'';
+    };
+
+    out << "DFA(states = ";
+    join(dfa.m_States, state);
+    out << ", inputAlphabet = ";
+    join(dfa.m_Alphabet, symbol);
+    out << ", initialState = " << dfa.m_InitialState << ", finalStates = ";
+    join(dfa.m_FinalStates, state);
+    out << ", transitions = ";
+    join(dfa.m_Transitions, [&](const auto& transition) {
+        out << '(' << transition.first.first << ", ";
+        symbol(transition.first.second);
+        out << ", " << transition.second << ')';
+    });
+    out << ")\n";
+}
+#endif
+
+// --- Binary format ----------------------------------------------------------
+
+#ifndef __PROGTEST__
+/**
+ * Header of the binary automat files. It is followed by the alphabet,
+ * the CSR offsets (as in NFATable), the targets and the final state bitmap,
+ * each part starts at a multiple of 8 bytes. Native endian, the magic
+ * does not match if the file comes from a machine of the other one. */
+struct MappedHeader {
+    uint32_t m_Magic;
+    uint32_t m_Width;
+    uint64_t m_States;
+    uint64_t m_Targets;
+    State m_Initial;
+    uint32_t m_Reserved;
+};
+
+const uint32_t mappedMagic = 0x4e474141;    // "AAGN"
+static_assert(sizeof(size_t) == sizeof(uint64_t), "the offsets are stored as they are in NFATable");
+
+size_t mappedAlign(const size_t bytes) {
+    return (bytes + 7) & ~(size_t) 7;
+}
+
+/** Byte offsets of the parts of a file, m_Size is the size of the whole file */
+struct MappedLayout {
+    size_t m_Alphabet, m_Offsets, m_Targets, m_Final, m_Size;
+
+    explicit MappedLayout(const MappedHeader& header) {
+        m_Alphabet = sizeof(MappedHeader);
+        m_Offsets = m_Alphabet + mappedAlign(header.m_Width);
+        m_Targets = m_Offsets + (header.m_States * header.m_Width + 1) * sizeof(uint64_t);
+        m_Final = m_Targets + mappedAlign(header.m_Targets * sizeof(State));
+        m_Size = m_Final + (header.m_States + 63) / 64 * sizeof(uint64_t);
+    }
+};
+
+/** Writes the table in the binary format */
+void writeMapped(ostream& out, const NFATable& nfa) {
+    const MappedHeader header{mappedMagic, (uint32_t) nfa.width(), nfa.size(), nfa.m_Targets.size(), nfa.m_Initial, 0};
+    const MappedLayout layout(header);
+
+    size_t position = 0;
+    const auto write = [&](const void* data, const size_t bytes) {
+        out.write((const char*) data, bytes);
+        position += bytes;
+    };
+    const auto pad = [&](const size_t offset) {
+        const char zeros[8] = {};
+        write(zeros, offset - position);
+    };
+
+    write(&header, sizeof(header));
+    write(nfa.m_Alphabet.data(), nfa.width());
+    pad(layout.m_Offsets);
+    write(nfa.m_Offsets.data(), nfa.m_Offsets.size() * sizeof(uint64_t));
+    write(nfa.m_Targets.data(), nfa.m_Targets.size() * sizeof(State));
+    pad(layout.m_Final);
+
+    vector<uint64_t> final((nfa.size() + 63) / 64, 0);
+    for (State state = 0; state < nfa.size(); ++state)
+        if (nfa.m_Final[state])
+            final[state / 64] |= (uint64_t) 1 << (state % 64);
+    write(final.data(), final.size() * sizeof(uint64_t));
+}
+
+bool saveMapped(const string& path, const NFATable& nfa) {
+    ofstream out(path, ios::binary);
+    writeMapped(out, nfa);
+    return (bool) out;
+}
+
+bool saveMapped(const string& path, const NFA& nfa) {
+    return saveMapped(path, nfaCompile(nfa, nfa.m_Alphabet));
+}
+
+bool saveMapped(const string& path, const DFA& dfa) {
+    return saveMapped(path, nfaFromTable(tableFromDFA(dfa)));
+}
+
+/**
+ * A binary automat file mapped into the memory. The transitions are read
+ * in place, so it can stand for a NFATable wherever the automat is only read
+ * (LazyTable, determinize, the product). Only the final flags are unpacked.
+ * The copies share the mapping, it is unmapped with the last one. */
+struct MappedNFA : Columns {
+    using Columns::Columns;
+
+    shared_ptr<const void> m_Mapping;
+    const uint64_t* m_Offsets = nullptr;
+    const State* m_Targets = nullptr;
+    vector<bool> m_Final;
+    State m_Initial = 0;
+
+    size_t size() const { return m_Final.size(); }
+    bool isFinal(const State state) const { return m_Final[state]; }
+
+    const State* targetsBegin(const State state, const Column column) const {
+        return m_Targets + m_Offsets[(size_t) state * width() + column];
+    }
+    const State* targetsEnd(const State state, const Column column) const {
+        return m_Targets + m_Offsets[(size_t) state * width() + column + 1];
+    }
+};
+
+/** Maps the file written by writeMapped, nullopt if it cannot be read or is not valid */
+optional<MappedNFA> loadMapped(const string& path) {
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) return nullopt;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || (size_t) status.st_size < sizeof(MappedHeader)) {
+        close(descriptor);
+        return nullopt;
+    }
+
+    const size_t length = status.st_size;
+    void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (address == MAP_FAILED) return nullopt;
+
+    const shared_ptr<const void> mapping(address, [length](const void* data) { munmap((void*) data, length); });
+    const char* base = (const char*) address;
+
+    // the sizes are checked against the file before they are multiplied
+    MappedHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (header.m_Magic != mappedMagic || header.m_Width > 256 || header.m_States == 0
+            || header.m_States > length || header.m_Targets > length || header.m_Initial >= header.m_States)
+        return nullopt;
+
+    const MappedLayout layout(header);
+    if (layout.m_Size != length) return nullopt;
+
+    const Symbol* alphabet = (const Symbol*) (base + layout.m_Alphabet);
+    if (adjacent_find(alphabet, alphabet + header.m_Width, greater_equal<Symbol>()) != alphabet + header.m_Width)
+        return nullopt;
+
+    MappedNFA nfa(vector<Symbol>(alphabet, alphabet + header.m_Width));
+    nfa.m_Mapping = mapping;
+    nfa.m_Offsets = (const uint64_t*) (base + layout.m_Offsets);
+    nfa.m_Targets = (const State*) (base + layout.m_Targets);
+    nfa.m_Initial = header.m_Initial;
+
+    const size_t cells = header.m_States * header.m_Width;
+    if (nfa.m_Offsets[0] != 0 || nfa.m_Offsets[cells] != header.m_Targets) return nullopt;
+    for (size_t i = 0; i < cells; ++i)
+        if (nfa.m_Offsets[i] > nfa.m_Offsets[i + 1]) return nullopt;
+    for (size_t i = 0; i < header.m_Targets; ++i)
+        if (nfa.m_Targets[i] >= header.m_States) return nullopt;
+
+    const uint64_t* final = (const uint64_t*) (base + layout.m_Final);
+    nfa.m_Final.resize(header.m_States);
+    for (State state = 0; state < header.m_States; ++state)
+        nfa.m_Final[state] = (final[state / 64] >> (state % 64)) & 1;
+
+    return nfa;
+}
+
+/** Copies the mapped automat into a table over the alphabet given, it must contain the automat's one */
+NFATable nfaFromMapped(const MappedNFA& nfa, const set<Symbol>& alphabet) {
+    NFATable result(alphabet);
+    result.m_Targets.assign(nfa.m_Targets, nfa.m_Targets + nfa.m_Offsets[nfa.size() * nfa.width()]);
+    result.m_Offsets.reserve(nfa.size() * result.width() + 1);
+    result.m_Offsets.emplace_back(0);
+
+    // the targets keep their order, only the empty columns are added
+    for (State state = 0; state < nfa.size(); ++state) {
+        for (Column column = 0; column < result.width(); ++column) {
+            const Column source = nfa.m_Columns[result.m_Alphabet[column]];
+            const size_t count = source == noColumn ? 0 : nfa.targetsEnd(state, source) - nfa.targetsBegin(state, source);
+            result.m_Offsets.emplace_back(result.m_Offsets.back() + count);
+        }
+    }
+
+    result.m_Final = nfa.m_Final;
+    result.m_Initial = nfa.m_Initial;
+    return result;
+}
+
+/** Converts the mapped automat into the NFA struct, the states are named [0, n> */
+NFA mappedToNFA(const MappedNFA& nfa) {
+    NFA result;
+    result.m_Alphabet.insert(nfa.m_Alphabet.begin(), nfa.m_Alphabet.end());
+    result.m_InitialState = nfa.m_Initial;
+
+    for (State state = 0; state < nfa.size(); ++state) {
+        result.m_States.emplace_hint(result.m_States.end(), state);
+        if (nfa.isFinal(state))
+            result.m_FinalStates.emplace_hint(result.m_FinalStates.end(), state);
+
+        for (Column column = 0; column < nfa.width(); ++column)
+            if (nfa.targetsBegin(state, column) != nfa.targetsEnd(state, column))
+                result.m_Transitions.emplace_hint(result.m_Transitions.end(), Config{state, nfa.m_Alphabet[column]},
+                        set<State>(nfa.targetsBegin(state, column), nfa.targetsEnd(state, column)));
+    }
+    return result;
+}
+
+/** Determinizes the mapped automat reading its transitions in place */
+Table determinize(const MappedNFA& nfa, const Options& options = {}) {
+    LazyTable<MappedNFA> lazy(nfa, options);
+    for (State current = 0; current < lazy.size(); ++current)
+        lazy.expand(current);
+    return move(lazy.m_Table);
+}
+
+/**
+ * The pipeline over the mapped automates. They are copied into tables over
+ * the common alphabet, or go through the cache as NFAs if there is one,
+ * the rest is the same as for the NFAs. */
+DFA handleMapped(const MappedNFA& nfa1, const MappedNFA& nfa2, const bool isIntersect, const Options& options) {
+    set<Symbol> alphabet(nfa1.m_Alphabet.begin(), nfa1.m_Alphabet.end());
+    alphabet.insert(nfa2.m_Alphabet.begin(), nfa2.m_Alphabet.end());
+
+    const auto compile = [&](const MappedNFA& nfa) {
+        if (options.m_Cache != nullptr)
+            return compileOperand(mappedToNFA(nfa), alphabet, options);
+        return nfaFromMapped(nfa, alphabet);
+    };
+    NFATable table1 = statisticsStage(options.m_Statistics, "compile1", [&](StageStatistics*) { return compile(nfa1); });
+    NFATable table2 = statisticsStage(options.m_Statistics, "compile2", [&](StageStatistics*) { return compile(nfa2); });
+    return handleProgtestCompiled(move(table1), move(table2), alphabet, isIntersect, options);
+}
+
+DFA unify    (const MappedNFA& a, const MappedNFA& b, const Options& options = {}) { return handleMapped(a, b, false, options); }
+DFA intersect(const MappedNFA& a, const MappedNFA& b, const Options& options = {}) { return handleMapped(a, b, true,  options); }
+#endif
 
-        // extract names
-        const State name = nameMaping.at(state);
-        const Config key = Config{name, symbol};
-        const State value = nameMaping.at(dest);
+// --- Matcher ----------------------------------------------------------------
 
-        // add to the final result
-        newTransitions.emplace(make_pair(key, value));
+#ifndef __PROGTEST__
+/**
+ * A DFA compiled for running the inputs through it. Each row has a column
+ * for every byte and the dead state is 0, so a step is a single load with
+ * no alphabet lookup and no check for a missing transition. */
+struct Matcher {
+    vector<State> m_Transitions;    // state x 256
+    vector<uint64_t> m_Final;       // bitmap
+    State m_Initial = 0;
+
+    size_t size() const { return m_Transitions.size() / 256; }
+    bool isFinal(const State state) const { return (m_Final[state / 64] >> (state % 64)) & 1; }
+};
 
-        if (parallelRunAddInFinal(dfa1, dfa2, state, isIntersect))
-            newFinite.emplace(name);
-        if (parallelRunAddInFinal(dfa1, dfa2, dest, isIntersect))
-            newFinite.emplace(value);
+Matcher matcherCompile(const Table& table) {
+    Matcher matcher;
+    matcher.m_Transitions.assign((table.size() + 1) * 256, 0);
+    matcher.m_Final.assign((table.size() + 1 + 63) / 64, 0);
+
+    // the states are shifted by one to make room for the dead one
+    for (State state = 0; state < table.size(); ++state) {
+        State* row = matcher.m_Transitions.data() + (size_t) (state + 1) * 256;
+        for (Column column = 0; column < table.width(); ++column)
+            if (table.row(state)[column] != noState)
+                row[table.m_Alphabet[column]] = table.row(state)[column] + 1;
+        if (table.isFinal(state))
+            matcher.m_Final[(state + 1) / 64] |= (uint64_t) 1 << ((state + 1) % 64);
     }
 
-    const DFA output = {
-        newStates,
-        dfa1.m_Alphabet,
-        newTransitions,
-        0,
-        newFinite
-    };
+    matcher.m_Initial = table.m_Initial + 1;
+    return matcher;
+}
 
-    return output;
+Matcher matcherCompile(const DFA& dfa) {
+    return matcherCompile(tableFromDFA(dfa));
 }
 
-/** Performs the parallel run algorithm
- * both automates must have the same alphabet
- * both automates must be full */
-DFA parallelRun(const DFA& dfa1, const DFA& dfa2, const bool isIntersect) {
-    const map<DoubleConfig, DoubleState> transitions = parallelRunTransitions(dfa1, dfa2);
-    const map<DoubleState, State> nameMaping = nameStates({dfa1.m_InitialState, dfa2.m_InitialState}, transitions);
-    return parallelRunApplyNaming(dfa1, dfa2, transitions, nameMaping, isIntersect);
+bool matches(const Matcher& matcher, const string_view input) {
+    State state = matcher.m_Initial;
+    for (const char byte : input)
+        state = matcher.m_Transitions[(size_t) state * 256 + (uint8_t) byte];
+    return matcher.isFinal(state);
 }
 
+const size_t matcherLanes = 8;
 
-// --- Full automat -----------------------------------------------------------
+/**
+ * Runs up to matcherLanes inputs together, one byte of each in turn, so the
+ * loads of the independent walks overlap instead of waiting for each other.
+ * All the walks advance by the shortest remaining length, then the finished
+ * ones are dropped and the rest continues. */
+void matcherWalk(const Matcher& matcher, const string_view* inputs, const size_t count, uint8_t* results) {
+    struct Walk {
+        State m_State;
+        const uint8_t* m_Cursor;
+        size_t m_Remaining;
+        size_t m_Index;
+    };
 
-DFA makeFull(const DFA& dfa, const set<Symbol>& alphabet) {
-    const State failState = dfa.m_States.size(); // last item + 1
-    map<Config, State> transitions = dfa.m_Transitions;
-    
-    // exploiting that states are indexed from 0 to len - 1
-    for (State state = 0; state < failState; ++state) {
-        for (const Symbol symbol : alphabet) {
-            const Config config = {state, symbol};
-            if (transitions.find(config) == transitions.end()) {
-                transitions.emplace(make_pair(config, failState));
+    array<Walk, matcherLanes> walks;
+    for (size_t i = 0; i < count; ++i)
+        walks[i] = {matcher.m_Initial, (const uint8_t*) inputs[i].data(), inputs[i].size(), i};
+
+    const State* transitions = matcher.m_Transitions.data();
+    size_t active = count;
+    while (active > 0) {
+        size_t steps = walks[0].m_Remaining;
+        for (size_t lane = 1; lane < active; ++lane)
+            steps = min(steps, walks[lane].m_Remaining);
+
+        for (size_t i = 0; i < steps; ++i)
+            for (size_t lane = 0; lane < active; ++lane)
+                walks[lane].m_State = transitions[(size_t) walks[lane].m_State * 256 + walks[lane].m_Cursor[i]];
+
+        // a finished walk is replaced by the last active one
+        for (size_t lane = 0; lane < active;) {
+            Walk& walk = walks[lane];
+            walk.m_Cursor += steps;
+            walk.m_Remaining -= steps;
+            if (walk.m_Remaining == 0) {
+                results[walk.m_Index] = matcher.isFinal(walk.m_State);
+                walk = walks[--active];
+            } else {
+                ++lane;
             }
         }
     }
-
-    // add transitions for the final state
-    for (const Symbol symbol : alphabet) {
-        const Config config = {failState, symbol};
-        transitions.emplace(make_pair(config, failState));
-    }
-
-    set<State> newStates = dfa.m_States;
-    newStates.emplace(failState);
-
-    return DFA{
-        newStates,
-        alphabet,
-        transitions,
-        dfa.m_InitialState,
-        dfa.m_FinalStates
-    };
 }
 
-DFA makeFull(const DFA& dfa) {
-    return makeFull(dfa, dfa.m_Alphabet);
+/** Accepts the inputs in batches of matcherLanes walks, split among the threads */
+vector<bool> matchBatch(const Matcher& matcher, const vector<string_view>& inputs, const size_t threads = 1) {
+    vector<uint8_t> results(inputs.size());
+    parallelChunks(threads, inputs.size(), 512 * matcherLanes, [&](size_t, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; i += matcherLanes)
+            matcherWalk(matcher, inputs.data() + i, min(matcherLanes, end - i), results.data() + i);
+    });
+    return vector<bool>(results.begin(), results.end());
 }
+#endif
 
-// --- Determinization --------------------------------------------------------
-
-using SetState = set<State>;
-using SetConfig = tuple<SetState, Symbol>;
+// --- Lazy matcher -----------------------------------------------------------
 
-map<SetConfig, SetState> determinizeTransitions(const NFA& nfa) {
-    map<SetConfig, SetState> createdTransitions;
+#ifndef __PROGTEST__
+/**
+ * Runs the inputs through the union or the intersection of two NFAs
+ * determinized on the fly, the way RE2 does. Each operand is a LazyTable and
+ * the pairs of their subsets are formed step by step as in the lazy
+ * parallelRun, so neither the operands nor the product are built further
+ * than the inputs get. The pairs visited and their rows are cached, all the
+ * caches are flushed and started again once they hold m_Capacity states
+ * together, so the memory stays bounded.
+ * Not thread safe, each thread needs its own matcher. */
+struct LazyMatcher {
+    NFATable m_NFA1;
+    NFATable m_NFA2;
+    bool m_IsIntersect;
+    LazyTable<> m_Lazy1;
+    LazyTable<> m_Lazy2;
+
+    // the pairs of the operand states visited, their rows are valid once expanded
+    Table m_Product;
+    vector<DoubleState> m_Pairs;
+    vector<bool> m_Expanded;
+    unordered_map<uint64_t, State> m_Names;
+    State m_Initial = 0;
+    size_t m_Capacity;
+
+    size_t m_Hits = 0;      // steps from an already expanded state
+    size_t m_Misses = 0;    // steps that had to expand the state first
+    size_t m_Flushes = 0;
+
+    /** Both the tables must be over the same alphabet */
+    LazyMatcher(NFATable nfa1, NFATable nfa2, const bool isIntersect,
+            const size_t capacity = 4096, const Options& options = {})
+        : m_NFA1(move(nfa1)),
+          m_NFA2(move(nfa2)),
+          m_IsIntersect(isIntersect),
+          m_Lazy1(m_NFA1, options),
+          m_Lazy2(m_NFA2, options),
+          m_Product(m_NFA1.m_Alphabet),
+          m_Capacity(max(capacity, (size_t) 2)) {
+        m_Initial = discover({m_Lazy1.m_Initial, m_Lazy2.m_Initial});
+    }
 
-    set<SetState> visited{{nfa.m_InitialState}};
-    queue<SetState> queue;
-    queue.push({nfa.m_InitialState});
+    // the caches refer to the tables
+    LazyMatcher(const LazyMatcher&) = delete;
+    LazyMatcher& operator=(const LazyMatcher&) = delete;
 
-    while (!queue.empty()) {
-        const SetState& stateGroup = queue.front();
+    /** States held by all the caches */
+    size_t size() const { return m_Product.size() + m_Lazy1.size() + m_Lazy2.size(); }
 
-        // holds all the states we can get to for the symbol given
-        map<Symbol, SetState> results;
+    double hitRate() const {
+        const size_t steps = m_Hits + m_Misses;
+        return steps == 0 ? 0 : (double) m_Hits / steps;
+    }
 
-        // iterate over all the nodes in state set
-        for (const auto& state : stateGroup) {
-            // iterate over all the symbols for the original state
-            auto itr = nfa.m_Transitions.lower_bound({state, 0});
+    bool matches(const string_view input) {
+        State state = m_Initial;
+        for (const char byte : input) {
+            const Column column = m_NFA1.m_Columns[(uint8_t) byte];
+            if (column == noColumn) return false;
 
-            for (; itr != nfa.m_Transitions.end() && get<0>(itr -> first) == state; ++itr) {
-                const Symbol symbol = itr -> first.second;
-                const SetState& targets = itr -> second;
-                results[symbol].insert(targets.begin(), targets.end());
+            if (m_Expanded[state]) {
+                ++m_Hits;
+            } else {
+                ++m_Misses;
+                if (size() >= m_Capacity)
+                    state = flush(state);
+                expand(state);
             }
-        }
-
-        // analyze the results
-        for (const auto& res : results) {
-            const SetConfig config = SetConfig(stateGroup, res.first);
-            const SetState& target = res.second;
-
-            // add into the final result, needs to be renamed
-            createdTransitions.emplace(make_pair(config, target));
 
-            // add into the next BFS pass
-            if (visited.find(target) == visited.end()) {
-                visited.emplace(stateGroup);
-                queue.push(target);
-            }
+            state = m_Product.row(state)[column];
+            if (state == noState) return false;
         }
-
-        queue.pop();
+        return m_Product.isFinal(state);
     }
 
-    return createdTransitions;
-}
-
-/**
- * Renames nodes according to the previously generated mapping 
- * and creates the finite notes set. Puts it all into the final DFA */
-DFA determinizeApplyNaming(
-        const NFA& nfa,
-        const map<SetConfig, SetState>& transitions,
-        const map<SetState, State>& nameMaping
-        ) {
-
-    // states are just integers in [0, n>
-    set<State> newStates = {0}; // the initial state must be always presented
-    for (size_t i = 0; i < nameMaping.size(); ++i)
-        newStates.emplace(i);
-
-    map<Config, State> newTransitions;
-    set<State> newFinite;
-
-    // make sure initial state is always present
-    {
-        const SetState initial = {nfa.m_InitialState};
-        if (checkIntersect(initial, nfa.m_FinalStates))
-            newFinite.emplace(nameMaping.at(initial));
+    /** Names the pair, the dead one is the missing transition unless it is the initial one */
+    State discover(DoubleState pair) {
+        pair = parallelRunCanonical(pair, m_Lazy1.m_Kinds, m_Lazy2.m_Kinds, m_IsIntersect);
+        if (pair == DoubleState{noState, noState} && !m_Pairs.empty())
+            return noState;
+
+        const auto [itr, inserted] = m_Names.emplace(parallelRunKey(pair), m_Product.size());
+        if (inserted) {
+            m_Product.addState(parallelRunAddInFinal(m_Lazy1, m_Lazy2, pair, m_IsIntersect));
+            m_Pairs.emplace_back(pair);
+            m_Expanded.push_back(false);
+        }
+        return itr -> second;
     }
 
-    for (const auto& transition : transitions) {
-        const auto& [setConfig, dest] = transition;
-        const auto [state, symbol] = setConfig;
+    /** Steps both the operands, they expand their subsets as they are asked for the rows */
+    void expand(const State state) {
+        const size_t width = m_Product.width();
+        const auto [state1, state2] = m_Pairs[state];
+        m_Expanded[state] = true;
 
-        // extract names
-        const State name = nameMaping.at(state);
-        const Config key = Config{name, symbol};
-        const State value = nameMaping.at(dest);
+        if (state1 == universalState) {
+            fill(m_Product.row(state), m_Product.row(state) + width, state);
+            return;
+        }
 
-        // add to the final result
-        newTransitions.emplace(make_pair(key, value));
+        const State* row1 = state1 == noState ? nullptr : m_Lazy1.row(state1);
+        const State* row2 = state2 == noState ? nullptr : m_Lazy2.row(state2);
 
-        // checks if the state is final
-        if (checkIntersect(state, nfa.m_FinalStates))
-            newFinite.emplace(name);
-        if (checkIntersect(dest, nfa.m_FinalStates))
-            newFinite.emplace(value);
+        for (Column column = 0; column < width; ++column) {
+            const State target1 = row1 == nullptr ? noState : row1[column];
+            const State target2 = row2 == nullptr ? noState : row2[column];
+            const State target = discover({target1, target2});
+            m_Product.row(state)[column] = target;
+        }
     }
 
-    const DFA output = {
-        newStates,
-        nfa.m_Alphabet,
-        newTransitions,
-        0,
-        newFinite
-    };
+    /** Empties the caches, returns the new name of the state given */
+    State flush(const State state) {
+        DoubleState pair = m_Pairs[state];
+        const bool subsets = pair.first != universalState;
+        vector<State> subset1, subset2;
+        if (subsets && pair.first != noState)
+            subset1.assign(m_Lazy1.m_Subsets.begin(pair.first), m_Lazy1.m_Subsets.end(pair.first));
+        if (subsets && pair.second != noState)
+            subset2.assign(m_Lazy2.m_Subsets.begin(pair.second), m_Lazy2.m_Subsets.end(pair.second));
+
+        m_Lazy1.reset({m_NFA1.m_Initial});
+        m_Lazy2.reset({m_NFA2.m_Initial});
+        m_Product = Table(m_NFA1.m_Alphabet);
+        m_Pairs.clear();
+        m_Expanded.clear();
+        m_Names.clear();
+        ++m_Flushes;
+
+        m_Initial = discover({m_Lazy1.m_Initial, m_Lazy2.m_Initial});
+        if (!subset1.empty()) pair.first = m_Lazy1.discover(subset1.data(), subset1.data() + subset1.size());
+        if (!subset2.empty()) pair.second = m_Lazy2.discover(subset2.data(), subset2.data() + subset2.size());
+        return discover(pair);
+    }
+};
 
-    return output;
+/** Matcher of the union or the intersection of the automates, without determinizing either */
+LazyMatcher lazyMatcher(const NFA& nfa1, const NFA& nfa2, const bool isIntersect,
+        const size_t capacity = 4096, const Options& options = {}) {
+    const set<Symbol> alphabet = commonAlphabet<NFA>(nfa1, nfa2);
+    return LazyMatcher(nfaCompile(nfa1, alphabet), nfaCompile(nfa2, alphabet), isIntersect, capacity, options);
 }
 
-/** Determinizes an automat */
-DFA determinize(const NFA& nfa) {
-    const map<SetConfig, SetState> transitions = determinizeTransitions(nfa);
-    const map<SetState, State> naming = nameStates(SetState({nfa.m_InitialState}), transitions);
-    return determinizeApplyNaming(nfa, transitions, naming);
+/** Matcher of a single automat, run as the union with the empty language */
+LazyMatcher lazyMatcher(const NFA& nfa, const size_t capacity = 4096, const Options& options = {}) {
+    return lazyMatcher(nfa, NFA{{0}, {}, {}, 0, {}}, false, capacity, options);
 }
 
-DFA handleProgtest(const NFA& nfa1, const NFA& nfa2, const bool isIntersect) {
-    const set<Symbol> alphabet = commonAlphabet<NFA>(nfa1, nfa2);
-    const DFA dfa1 = makeFull(determinize(nfa1), alphabet);
-    const DFA dfa2 = makeFull(determinize(nfa2), alphabet);
-    return minimize(parallelRun(dfa1, dfa2, isIntersect));
+vector<bool> matchBatch(LazyMatcher& matcher, const vector<string_view>& inputs) {
+    vector<bool> results(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i)
+        results[i] = matcher.matches(inputs[i]);
+    return results;
 }
-
-DFA unify    (const NFA& a, const NFA& b) { return handleProgtest(a, b, false); }
-DFA intersect(const NFA& a, const NFA& b) { return handleProgtest(a, b, true ); }
+#endif
 
 #ifndef __PROGTEST__
 
@@ -712,8 +4064,15 @@ bool operator==(const DFA& a, const DFA& b) {
 }
 
 void tests();
+int benchmarks(const int argc, char** argv);
+int command(const int argc, char** argv);
+
+int main(int argc, char** argv) {
+    if (argc > 1 && string(argv[1]) == "bench")
+        return benchmarks(argc, argv);
+    if (argc > 1)
+        return command(argc, argv);
 
-int main(void) {
     tests();
     return 0;
 }
@@ -734,20 +4093,29 @@ void print(const DFA& dfa, ostream& out = cout) {
         dfa.m_FinalStates << endl;
 }
 
+void print(const Table& table, ostream& out = cout) {
+    print(tableToDFA(table), out);
+}
+
 void printCommon(const DFA& dfa, ostream& out = cout) {
     const DFA aut = commonNaming(dfa);
     print(aut);
 }
 
+void printCommon(const Table& table, ostream& out = cout) {
+    printCommon(tableToDFA(table), out);
+}
+
 void printDeterminization(const NFA& nfa1, const NFA& nfa2, const DFA& dfa) {
-    const DFA d1 = determinize(nfa1);
-    const DFA f1 = makeFull(d1);
-    const DFA d2 = determinize(nfa2);
-    const DFA f2 = makeFull(d2);
-    const DFA in = parallelRun(f1, f2, true);
-    const DFA un = parallelRun(f1, f2, false);
-    const DFA us = minimizeRemoveUseless(in);
-    const DFA mn = minimize(in);
+    const set<Symbol> alphabet = commonAlphabet(nfa1, nfa2);
+    const Table d1 = determinize(nfa1, alphabet);
+    const Table f1 = makeFull(d1);
+    const Table d2 = determinize(nfa2, alphabet);
+    const Table f2 = makeFull(d2);
+    const Table in = parallelRun(f1, f2, true);
+    const Table un = parallelRun(f1, f2, false);
+    const Table us = minimizeRemoveUseless(in);
+    const Table mn = minimize(in);
 
     separator("A1");
     print(d1);
@@ -826,6 +4194,31 @@ void testA() {
     printDeterminization(a1, a2, a);
     assert(commonNaming(a) == a);
     assert(commonNaming(intersect(a1, a2)) == a);
+    assert(equivalent(intersect(a1, a2), a));
+
+    Statistics statistics;
+    Options options;
+    options.m_Lazy = false;
+    options.m_Statistics = &statistics;
+    assert(commonNaming(intersect(a1, a2, options)) == a);
+    assert(statistics.m_Stages.front().m_Name == "compile1");
+#ifdef HAS_ALLOCATION_COUNTERS
+    assert(statistics.m_Stages.front().m_AllocatedBytes != 0);
+#endif
+    const auto findStage = [&](const string& name) {
+        return find_if(statistics.m_Stages.begin(), statistics.m_Stages.end(),
+                [&](const StageStatistics& stage) { return stage.m_Name == name; });
+    };
+    assert(findStage("determinize1") != statistics.m_Stages.end());
+    assert(findStage("trim1") < findStage("determinize1"));
+    assert(statistics.m_Stages.back().m_States == a.m_States.size());
+    assert(statistics.m_Stages.back().m_Rounds != 0);
+    Options moore;
+    moore.m_Minimizer = Minimizer::Moore;
+    assert(commonNaming(intersect(a1, a2, moore)) == a);
+    Options eager;
+    eager.m_Lazy = false;
+    assert(commonNaming(intersect(a1, a2, eager)) == a);
 
     cout << "\n\n\n" << flush;
 }
@@ -889,6 +4282,12 @@ void testB() {
 
     assert(commonNaming(b) == b);
     assert(commonNaming(unify(b1, b2)) == b);
+    Options moore;
+    moore.m_Minimizer = Minimizer::Moore;
+    assert(commonNaming(unify(b1, b2, moore)) == b);
+    Options bitsets;
+    bitsets.m_Successors = Successors::Bitsets;
+    assert(commonNaming(unify(b1, b2, bitsets)) == b);
     cout << "\n\n\n" << flush;
 }
 
@@ -931,6 +4330,12 @@ void testC() {
 
     assert(commonNaming(c) == c);
     assert(commonNaming(intersect(c1, c2)) == c);
+    Options moore;
+    moore.m_Minimizer = Minimizer::Moore;
+    assert(commonNaming(intersect(c1, c2, moore)) == c);
+    Options eager;
+    eager.m_Lazy = false;
+    assert(commonNaming(intersect(c1, c2, eager)) == c);
 
     cout << "\n\n\n" << flush;
 }
@@ -987,6 +4392,452 @@ void testD() {
 
     assert(commonNaming(d) == d);
     assert(commonNaming(intersect(d1, d2)) == d);
+    assert(equivalent(intersect(d1, d2), d));
+
+    Options uncompressed;
+    uncompressed.m_CompressAlphabet = false;
+    assert(commonNaming(intersect(d1, d2, uncompressed)) == d);
+    Options moore;
+    moore.m_Minimizer = Minimizer::Moore;
+    assert(commonNaming(intersect(d1, d2, moore)) == d);
+    Options bitsets;
+    bitsets.m_Successors = Successors::Bitsets;
+    assert(commonNaming(intersect(d1, d2, bitsets)) == d);
+
+    cout << "\n\n\n" << flush;
+}
+
+/** Checks if the word is accepted by the automat */
+bool accepts(const NFA& nfa, const vector<Symbol>& word) {
+    set<State> current = {nfa.m_InitialState};
+    for (const Symbol symbol : word) {
+        set<State> next;
+        for (const State state : current) {
+            const auto itr = nfa.m_Transitions.find({state, symbol});
+            if (itr != nfa.m_Transitions.end())
+                next.insert(itr -> second.begin(), itr -> second.end());
+        }
+        swap(current, next);
+    }
+    return any_of(current.begin(), current.end(),
+            [&](const State state) { return nfa.m_FinalStates.count(state) != 0; });
+}
+
+/** A file name of this process in the temp directory, parallel runs of the tests don't share it */
+filesystem::path temporaryPath(const string& name) {
+    return filesystem::temp_directory_path() / ("aag-" + to_string(getpid()) + "-" + name);
+}
+
+// the automata shared by the feature tests below
+
+/** Ends with aa */
+NFA endsWithAA() {
+    return {
+        {0, 1, 2},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {0, 1}},
+            {{0, 'b'}, {0}},
+            {{1, 'a'}, {2}},
+        },
+        0,
+        {2},
+    };
+}
+
+/** Starts with aa */
+NFA startsWithAA() {
+    return {
+        {0, 1, 2},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {1}},
+            {{1, 'a'}, {2}},
+            {{2, 'a'}, {2}},
+            {{2, 'b'}, {2}},
+        },
+        0,
+        {2},
+    };
+}
+
+/** Ends with a */
+NFA endsWithA() {
+    return {
+        {0, 1},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {0, 1}},
+            {{0, 'b'}, {0}},
+        },
+        0,
+        {1},
+    };
+}
+
+/** Starts with b */
+NFA startsWithB() {
+    return {
+        {0, 1},
+        {'a', 'b'},
+        {
+            {{0, 'b'}, {1}},
+            {{1, 'a'}, {1}},
+            {{1, 'b'}, {1}},
+        },
+        0,
+        {1},
+    };
+}
+
+/** Ends with aa, with an unreachable state (3) and a dead one (4) */
+NFA endsWithAAUseless() {
+    NFA nfa = endsWithAA();
+    nfa.m_States.insert({3, 4});
+    nfa.m_Transitions[{3, 'a'}] = {2};
+    nfa.m_Transitions[{1, 'b'}] = {4};
+    nfa.m_Transitions[{4, 'a'}] = {4};
+    return nfa;
+}
+
+/** Ends with aa, the path is there twice */
+NFA endsWithAATwice() {
+    return {
+        {0, 1, 2, 3, 4},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {0, 1, 3}},
+            {{0, 'b'}, {0}},
+            {{1, 'a'}, {2}},
+            {{3, 'a'}, {4}},
+        },
+        0,
+        {2, 4},
+    };
+}
+
+void testQueries() {
+    separator("TEST QUERIES");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA(), e3 = endsWithA(), e4 = startsWithB();
+
+    vector<Symbol> word;
+    assert(!isIntersectionEmpty(e1, e2, &word));
+    assert(accepts(e1, word) && accepts(e2, word));
+    assert(isIntersectionEmpty(e2, e4));
+
+    assert(isIncluded(e1, e3));
+    assert(!isIncluded(e3, e1, &word));
+    assert(word == vector<Symbol>{'a'});
+    assert(!isIncluded(e4, e3, &word));
+    assert(accepts(e4, word) && !accepts(e3, word));
+
+    assert(equivalent(e1, e1));
+    assert(!equivalent(e1, e3, &word));
+    assert(accepts(e1, word) != accepts(e3, word));
+    assert(equivalent(unify(e1, e3), intersect(e3, e3)));
+
+    cout << "\n\n\n" << flush;
+}
+
+void testNary() {
+    separator("TEST N-ARY");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA(), e3 = endsWithA(), e4 = startsWithB();
+
+    assert(equivalent(intersect({e1, e3}), intersect(e1, e3)));
+    assert(equivalent(unify({e1, e2, e4}), unify(dfaToNFA(unify(e1, e2)), e4)));
+    Options minimized;
+    minimized.m_MinimizeOperands = true;
+    assert(equivalent(intersect({e1, e2, e3}, minimized), intersect(dfaToNFA(intersect(e1, e2)), e3)));
+
+    cout << "\n\n\n" << flush;
+}
+
+void testTrim() {
+    separator("TEST TRIM");
+    const NFA e1 = endsWithAA(), e4 = startsWithB(), e5 = endsWithAAUseless();
+
+    const NFATable trimmed = nfaTrim(nfaCompile(e5, e5.m_Alphabet));
+    assert(trimmed.size() == 3 && trimmed.m_Targets.size() == 4);
+    assert(equivalent(unify(e5, e4), unify(e1, e4)));
+
+    cout << "\n\n\n" << flush;
+}
+
+void testThreads() {
+    separator("TEST THREADS");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA();
+
+    // the workers must name the subsets as the sequential version does
+    Options threaded;
+    threaded.m_Lazy = false;
+    threaded.m_Threads = 4;
+    const NFATable compiled = nfaCompile(e1, e1.m_Alphabet);
+    const Table sequential = determinize(compiled);
+    const Table parallel = determinize(compiled, threaded);
+    assert(parallel.m_Transitions == sequential.m_Transitions && parallel.m_Final == sequential.m_Final);
+    assert(unify(e1, e2, threaded) == unify(e1, e2));
+
+    // Moore's refinement sorts in blocks only on large tables
+    mt19937 random(3);
+    Table large(e1.m_Alphabet);
+    for (State state = 0; state < 50000; ++state) {
+        const State name = large.addState(random() % 8 == 0);
+        large.row(name)[0] = random() % 50000;
+        large.row(name)[1] = (name + 1) % 50000;
+    }
+    const Table useful = minimizeRemoveUseless(large);
+    assert(useful.size() >= 4 * radixSortBlock);
+    const Table moore = minimizeEquiv(useful, nullptr, 4);
+    assert(moore.m_Transitions == minimizeEquiv(useful).m_Transitions && moore.size() == minimizeHopcroft(useful).size());
+    threaded.m_Minimizer = Minimizer::Moore;
+    assert(intersect(e1, e2, threaded) == intersect(e1, e2));
+
+    const Table product = parallelRunConcurrent(sequential, sequential, true, 4);
+    assert(product.m_Transitions == parallelRun(sequential, sequential, true).m_Transitions);
+
+    cout << "\n\n\n" << flush;
+}
+
+void testReduction() {
+    separator("TEST REDUCTION");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA(), e6 = endsWithAATwice();
+
+    const NFATable doubled = nfaCompile(e6, e6.m_Alphabet);
+    assert(nfaReduce(doubled, Reduction::Bisimulation).size() == 3);
+    assert(nfaReduce(doubled, Reduction::Simulation).size() == 3);
+    shared_ptr<const Simulation> kept;
+    const NFATable quotient = nfaReduce(doubled, Reduction::Simulation, &kept);
+    const Simulation recomputed(quotient);
+    for (State state = 0; state < quotient.size(); ++state)
+        for (State other = 0; other < quotient.size(); ++other)
+            assert(!kept -> simulates(state, other) || recomputed.simulates(state, other));
+    Options reduced;
+    reduced.m_Reduction = Reduction::Simulation;
+    assert(intersect(e6, e2, reduced) == intersect(e1, e2));
+    reduced.m_Threads = 4;
+    const Table pruned = determinize(doubled, reduced);
+    reduced.m_Threads = 1;
+    assert(pruned.m_Transitions == determinize(doubled, reduced).m_Transitions);
+
+    cout << "\n\n\n" << flush;
+}
+
+void testReversal() {
+    separator("TEST REVERSAL");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA(), e3 = endsWithA(), e4 = startsWithB();
+
+    assert(equivalent(reverse(e2), e1));
+    assert(equivalent(reverse(reverse(e1)), e1));
+    assert(equivalent(reverse(intersect(e1, e2)), dfaToNFA(intersect(reverse(e2), reverse(e1)))));
+
+    Statistics statistics;
+    Options brzozowski;
+    brzozowski.m_Pipeline = Pipeline::Brzozowski;
+    brzozowski.m_Statistics = &statistics;
+    assert(intersect(e1, e2, brzozowski) == intersect(e1, e2));
+    assert(unify(e2, e4, brzozowski) == unify(e2, e4));
+    assert(statistics.m_Decisions.size() == 2 && statistics.m_Decisions[0].m_Forced);
+    assert(statistics.m_Stages.back().m_Name == "brzozowski");
+    // the selector samples only when asked to
+    Options selected;
+    selected.m_Pipeline = Pipeline::Auto;
+    selected.m_Statistics = &statistics;
+    assert(intersect(e1, e3, selected) == intersect(e1, e3));
+    assert(statistics.m_Decisions.size() == 3 && !statistics.m_Decisions.back().m_Forced);
+    assert(statistics.m_Decisions.back().m_SampleLimit != 0);
+    Options minimizer;
+    minimizer.m_Minimizer = Minimizer::Brzozowski;
+    assert(unify(e1, e3, minimizer) == unify(e1, e3));
+
+    cout << "\n\n\n" << flush;
+}
+
+void testALT() {
+    separator("TEST ALT");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA();
+
+    ostringstream written;
+    writeALT(written, intersect(e1, e2));
+    const optional<NFA> parsed = parseALT(written.str());
+    assert(parsed && equivalent(*parsed, dfaToNFA(intersect(e1, e2))));
+    assert(parseALT(" NFA ( states = {0}, inputAlphabet = {'a'}, initialState = 0,\n finalStates = {}, transitions = {} ) "));
+    const char* error = nullptr;
+    const string invalid = "NFA(states = {0}, inputAlphabet = {a}, initialState = 0, finalStates = {}, transitions = {(0, a 0)})";
+    assert(!parseALT(invalid, &error) && error == invalid.data() + invalid.find("a 0") + 2);
+
+    // every symbol value survives, the separators and the quote included
+    DFA bytes{{0, 1}, {}, {}, 0, {1}};
+    for (size_t value = 0; value < 256; ++value) {
+        bytes.m_Alphabet.insert(value);
+        bytes.m_Transitions[{0, (Symbol) value}] = value % 2;
+    }
+    ostringstream writtenBytes;
+    writeALT(writtenBytes, bytes);
+    const optional<NFA> parsedBytes = parseALT(writtenBytes.str());
+    assert(parsedBytes && parsedBytes -> m_Alphabet == bytes.m_Alphabet && parsedBytes -> m_Transitions.size() == 256);
+    for (const auto& [config, target] : bytes.m_Transitions)
+        assert(parsedBytes -> m_Transitions.at(config) == set<State>{target});
+
+    cout << "\n\n\n" << flush;
+}
+
+void testCache() {
+    separator("TEST CACHE");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA(), e3 = endsWithA();
+
+    OperandCache cache(2);
+    Options cached;
+    cached.m_Cache = &cache;
+    assert(intersect(e1, e2, cached) == intersect(e1, e2));
+    assert(unify(e2, e1, cached) == unify(e1, e2));
+    assert(cache.m_Misses == 2 && cache.m_Hits == 2);
+    // an operand with the same fingerprint must not be taken for the cached one
+    cache.m_Entries.front().m_Key += "collision";
+    assert(intersect(e1, e2, cached) == intersect(e1, e2) && cache.m_Misses == 3);
+
+    const filesystem::path cacheDirectory = temporaryPath("cache");
+    filesystem::create_directory(cacheDirectory);
+    OperandCache disk(1, cacheDirectory.string());
+    cached.m_Cache = &disk;
+    assert(unify(e1, e3, cached) == unify(e1, e3) && unify(e1, e3, cached) == unify(e1, e3));
+    assert(disk.m_Misses == 2 && disk.m_DiskHits != 0);
+    filesystem::copy_file(disk.path(nfaFingerprint(e3) ^ 1), disk.path(nfaFingerprint(e1) ^ 1),
+            filesystem::copy_options::overwrite_existing);
+    OperandCache reopened(4, cacheDirectory.string());
+    cached.m_Cache = &reopened;
+    assert(intersect(e1, e3, cached) == intersect(e1, e3));
+    assert(reopened.m_Misses == 1 && reopened.m_DiskHits == 1);
+    assert(distance(filesystem::directory_iterator(cacheDirectory), filesystem::directory_iterator()) == 2);
+    filesystem::remove_all(cacheDirectory);
+    assert(nfaFingerprint(e1) != nfaFingerprint(e3) && nfaFingerprint(e1) == nfaFingerprint(NFA(e1)));
+
+    const Table sequential = determinize(nfaCompile(e1, e1.m_Alphabet));
+    stringstream stored;
+    tableWrite(stored, sequential);
+    const optional<Table> loaded = tableRead(stored);
+    assert(loaded && loaded -> m_Transitions == sequential.m_Transitions && loaded -> m_Final == sequential.m_Final);
+    stringstream garbage("not a table");
+    assert(!tableRead(garbage));
+
+    cout << "\n\n\n" << flush;
+}
+
+void testMapped() {
+    separator("TEST MAPPED");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA();
+    NFA e7 = startsWithB();
+    e7.m_Alphabet.insert('c');
+
+    const string path1 = temporaryPath("e1.aag").string();
+    const string path2 = temporaryPath("e2.aag").string();
+    const string path7 = temporaryPath("e7.aag").string();
+    assert(saveMapped(path1, e1) && saveMapped(path2, e2));
+    assert(saveMapped(path7, dfaToNFA(unify(e7, e7))));
+    const optional<MappedNFA> mapped1 = loadMapped(path1);
+    const optional<MappedNFA> mapped2 = loadMapped(path2);
+    const optional<MappedNFA> mapped7 = loadMapped(path7);
+    assert(mapped1 && mapped2 && mapped7);
+    assert(equivalent(mappedToNFA(*mapped1), e1));
+    assert(determinize(*mapped1).m_Transitions == determinize(nfaCompile(e1, e1.m_Alphabet), {}).m_Transitions);
+    assert(intersect(*mapped1, *mapped2) == intersect(e1, e2));
+    assert(unify(*mapped1, *mapped7) == unify(e1, e7));
+    Statistics statistics;
+    Options options;
+    options.m_Statistics = &statistics;
+    assert(intersect(*mapped1, *mapped2, options) == intersect(e1, e2));
+    assert(any_of(statistics.m_Stages.begin(), statistics.m_Stages.end(),
+            [](const StageStatistics& stage) { return stage.m_Name == "trim1"; }));
+    ofstream(path1, ios::binary | ios::app) << 'x';
+    assert(!loadMapped(path1) && !loadMapped(temporaryPath("missing.aag").string()));
+    for (const string& path : {path1, path2, path7})
+        filesystem::remove(path);
+
+    cout << "\n\n\n" << flush;
+}
+
+/** Random words over {a, b, c} up to 11 symbols long */
+vector<string> randomTexts(const size_t count) {
+    mt19937 generator(7);
+    vector<string> texts;
+    for (size_t i = 0; i < count; ++i) {
+        string text(generator() % 12, 'a');
+        for (char& c : text) c = "abc"[generator() % 3];
+        texts.push_back(text);
+    }
+    return texts;
+}
+
+void testMatcher() {
+    separator("TEST MATCHER");
+    const NFA e2 = startsWithAA(), e4 = startsWithB();
+
+    const Matcher matcher = matcherCompile(unify(e2, e4));
+    assert(matches(matcher, "aab") && matches(matcher, "ba") && !matches(matcher, "ab") && !matches(matcher, ""));
+    assert(!matches(matcher, "aac") && !matches(matcher, "ca"));
+    const vector<string> texts = randomTexts(20000);
+    const vector<string_view> views(texts.begin(), texts.end());
+    const vector<bool> batch = matchBatch(matcher, views, 4);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const vector<Symbol> word(texts[i].begin(), texts[i].end());
+        assert(batch[i] == matches(matcher, texts[i]) && batch[i] == (accepts(e2, word) || accepts(e4, word)));
+    }
+    assert(batch == matchBatch(matcher, views));
+
+    cout << "\n\n\n" << flush;
+}
+
+void testLazyMatcher() {
+    separator("TEST LAZY MATCHER");
+    const NFA e1 = endsWithAA(), e2 = startsWithAA(), e4 = startsWithB();
+
+    const vector<string> texts = randomTexts(20000);
+    const vector<string_view> views(texts.begin(), texts.end());
+    LazyMatcher lazy = lazyMatcher(e2, e4, false, 7);
+    assert(matchBatch(lazy, views) == matchBatch(matcherCompile(unify(e2, e4)), views));
+    // a flush leaves up to two states in each cache, one expansion adds up to width to each
+    assert(lazy.m_Flushes > 0 && lazy.size() <= 6 + 3 * lazy.m_Product.width());
+    assert(lazy.m_Hits + lazy.m_Misses > 0 && lazy.hitRate() > 0.5);
+    // the intersection builds only the pairs the inputs get to
+    LazyMatcher both = lazyMatcher(e1, e2, true);
+    assert(!both.matches("ba") && both.m_Product.size() == 2);
+    assert(both.matches("aaa") && !both.matches("aab"));
+    Table full1 = determinize(both.m_NFA1), full2 = determinize(both.m_NFA2);
+    assert(both.m_Flushes == 0 && both.m_Product.size() < parallelRun(full1, full2, true).size());
+    LazyMatcher single = lazyMatcher(e1);
+    assert(single.matches("baa") && !single.matches("aab") && !single.matches(""));
+
+    cout << "\n\n\n" << flush;
+}
+
+void testBatch() {
+    separator("TEST BATCH");
+
+    const vector<NFA> operands = {endsWithAA(), startsWithAA(), endsWithA(), startsWithB(), endsWithAAUseless()};
+    vector<Job> jobs;
+    vector<DFA> expected;
+    for (size_t i = 0; i < 40; ++i) {
+        const NFA& first = operands[i % operands.size()];
+        const NFA& second = operands[i / operands.size() % operands.size()];
+        jobs.push_back({i % 3 == 0, &first, &second});
+        expected.push_back(i % 3 == 0 ? intersect(first, second) : unify(first, second));
+    }
+    Statistics statistics;
+    Options parallel;
+    parallel.m_Threads = 4;
+    parallel.m_Statistics = &statistics;
+    assert(runBatch(jobs, parallel) == expected);
+    assert(count_if(statistics.m_Stages.begin(), statistics.m_Stages.end(),
+            [](const StageStatistics& stage) { return stage.m_Name == "compile1"; }) == 40);
+#ifdef HAS_ALLOCATION_COUNTERS
+    for (const StageStatistics& stage : statistics.m_Stages)
+        assert(stage.m_PeakBytes <= stage.m_AllocatedBytes);
+#endif
+    OperandCache sharedCache(16);
+    parallel.m_Cache = &sharedCache;
+    assert(runBatch(jobs, parallel, true) == expected);
+    assert(sharedCache.m_Misses + sharedCache.m_Hits == 80);
+    assert(sharedCache.m_Misses <= parallel.m_Threads * operands.size());
+    assert(runBatch({}, parallel).empty());
 
     cout << "\n\n\n" << flush;
 }
@@ -996,5 +4847,315 @@ void tests() {
     testB();
     testC();
     testD();
+    testQueries();
+    testNary();
+    testTrim();
+    testThreads();
+    testReduction();
+    testReversal();
+    testALT();
+    testCache();
+    testMapped();
+    testMatcher();
+    testLazyMatcher();
+    testBatch();
+}
+
+// --- Benchmarks -------------------------------------------------------------
+
+struct GeneratorParams {
+    size_t m_States = 100;
+    size_t m_Alphabet = 2;
+    double m_Density = 0.5;         // probability a (state, symbol) pair has any transition
+    size_t m_Nondeterminism = 2;    // max number of targets of a transition
+    double m_FinalRatio = 0.2;
+    uint32_t m_Seed = 1;
+};
+
+/** Generates a random NFA, the same params always give the same automat */
+NFA generateRandom(const GeneratorParams& params) {
+    mt19937 rng(params.m_Seed);
+    uniform_int_distribution<State> stateDist(0, params.m_States - 1);
+    uniform_int_distribution<size_t> targetsDist(1, max<size_t>(1, params.m_Nondeterminism));
+    uniform_real_distribution<double> chance(0, 1);
+
+    NFA nfa;
+    for (State state = 0; state < params.m_States; ++state)
+        nfa.m_States.emplace(state);
+    for (size_t i = 0; i < params.m_Alphabet; ++i)
+        nfa.m_Alphabet.emplace('a' + i);
+
+    for (const State state : nfa.m_States) {
+        for (const Symbol symbol : nfa.m_Alphabet) {
+            if (chance(rng) >= params.m_Density) continue;
+
+            set<State>& targets = nfa.m_Transitions[{state, symbol}];
+            for (size_t count = targetsDist(rng); count > 0; --count)
+                targets.emplace(stateDist(rng));
+        }
+        if (chance(rng) < params.m_FinalRatio)
+            nfa.m_FinalStates.emplace(state);
+    }
+
+    nfa.m_InitialState = 0;
+    return nfa;
+}
+
+/** Words over {a, b} with an a at the n-th position from the end, the DFA needs 2^n states */
+NFA generateNthFromEnd(const size_t n) {
+    NFA nfa;
+    for (State state = 0; state <= n; ++state)
+        nfa.m_States.emplace(state);
+    nfa.m_Alphabet = {'a', 'b'};
+
+    nfa.m_Transitions[{0, 'a'}] = {0, 1};
+    nfa.m_Transitions[{0, 'b'}] = {0};
+    for (State state = 1; state < n; ++state) {
+        nfa.m_Transitions[{state, 'a'}] = {state + 1};
+        nfa.m_Transitions[{state, 'b'}] = {state + 1};
+    }
+
+    nfa.m_InitialState = 0;
+    nfa.m_FinalStates = {(State) n};
+    return nfa;
+}
+
+struct BenchRow {
+    string m_Case;
+    string m_Stage;
+    size_t m_States;
+    size_t m_Transitions;
+    double m_Seconds;
+    size_t m_Bytes = 0;     // input matched, for the matcher rows
+};
+
+/** Runs the stage, records its time and the size of its output */
+template<typename Stage>
+Table benchStage(vector<BenchRow>& rows, const string& name, const string& stage, const Stage& run) {
+    const auto start = chrono::steady_clock::now();
+    Table result = run();
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    rows.push_back({name, stage, result.size(), countTransitions(result), elapsed.count()});
+    return result;
+}
+
+/** Runs random inputs over the table's alphabet through its compiled matcher */
+void benchMatcher(vector<BenchRow>& rows, const string& name, const Table& table, const uint32_t seed) {
+    mt19937 generator(seed);
+    vector<string> texts(100000);
+    size_t bytes = 0;
+    for (string& text : texts) {
+        text.resize(16 + generator() % 240);
+        for (char& c : text)
+            c = table.m_Alphabet[generator() % table.width()];
+        bytes += text.size();
+    }
+    const vector<string_view> views(texts.begin(), texts.end());
+
+    const Matcher matcher = matcherCompile(table);
+    vector<size_t> threadCounts = {1};
+    if (thread::hardware_concurrency() > 1)
+        threadCounts.push_back(thread::hardware_concurrency());
+
+    for (const size_t threads : threadCounts) {
+        const auto start = chrono::steady_clock::now();
+        matchBatch(matcher, views, threads);
+        const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        rows.push_back({name, "matchBatch" + to_string(threads), matcher.size(), countTransitions(table),
+                elapsed.count(), bytes});
+    }
+}
+
+void benchCase(vector<BenchRow>& rows, const string& name, const NFA& nfa1, const NFA& nfa2, const bool isIntersect) {
+    const set<Symbol> alphabet = commonAlphabet<NFA>(nfa1, nfa2);
+
+    const Table d1 = benchStage(rows, name, "determinize1", [&]() { return determinize(nfa1, alphabet); });
+    const Table d2 = benchStage(rows, name, "determinize2", [&]() { return determinize(nfa2, alphabet); });
+    const Table pr = benchStage(rows, name, "parallelRun", [&]() { return parallelRun(d1, d2, isIntersect); });
+    const Table us = benchStage(rows, name, "minimizeRemoveUseless", [&]() { return minimizeRemoveUseless(pr); });
+    benchStage(rows, name, "minimizeEquiv", [&]() { return minimizeEquiv(us); });
+    const Table mi = benchStage(rows, name, "minimizeHopcroft", [&]() { return minimizeHopcroft(us); });
+    benchMatcher(rows, name, mi, (uint32_t) us.size());
+}
+
+void benchPrint(const vector<BenchRow>& rows, const bool json, ostream& out = cout) {
+    if (json) out << "[\n";
+    else out << "case,stage,states,transitions,seconds,states_per_second,bytes_per_second\n";
+
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const BenchRow& row = rows[i];
+        const double throughput = row.m_Seconds > 0 ? row.m_States / row.m_Seconds : 0;
+        const double bytes = row.m_Seconds > 0 ? row.m_Bytes / row.m_Seconds : 0;
+
+        if (json) {
+            out << "  {\"case\": \"" << row.m_Case << "\", \"stage\": \"" << row.m_Stage
+                << "\", \"states\": " << row.m_States << ", \"transitions\": " << row.m_Transitions
+                << ", \"seconds\": " << row.m_Seconds << ", \"states_per_second\": " << throughput
+                << ", \"bytes_per_second\": " << bytes << "}" << (i + 1 == rows.size() ? "\n" : ",\n");
+        } else {
+            out << row.m_Case << "," << row.m_Stage << "," << row.m_States << "," << row.m_Transitions
+                << "," << row.m_Seconds << "," << throughput << "," << bytes << "\n";
+        }
+    }
+
+    if (json) out << "]\n";
+    out << flush;
+}
+
+static const char* const benchUsage = "bench [csv|json] [seed] [states alphabet density]";
+
+/** Usage: bench [csv|json] [seed] [states alphabet density], the given random case replaces the built-in ones */
+int benchmarks(const int argc, char** argv) {
+    const string format = argc > 2 ? argv[2] : "csv";
+    uint32_t seed = 1;
+    // (states, alphabet, density)
+    vector<tuple<size_t, size_t, double>> cases = {{50, 4, 0.5}, {100, 4, 0.5}, {300, 3, 0.3}};
+
+    try {
+        if ((format != "csv" && format != "json") || argc == 5 || argc == 6 || argc > 7)
+            throw invalid_argument(format);
+        if (argc > 3) seed = stoul(argv[3]);
+        if (argc == 7) {
+            const size_t states = stoul(argv[4]), alphabet = stoul(argv[5]);
+            const double density = stod(argv[6]);
+            if (states == 0 || alphabet == 0 || alphabet > 26 || !(density >= 0 && density <= 1))
+                throw out_of_range(argv[4]);
+            cases = {{states, alphabet, density}};
+        }
+    } catch (const logic_error&) {
+        cerr << "usage: " << argv[0] << " " << benchUsage << endl;
+        return 2;
+    }
+    const bool json = format == "json";
+
+    vector<BenchRow> rows;
+
+    for (const auto& [states, alphabet, density] : cases) {
+        GeneratorParams params;
+        params.m_States = states;
+        params.m_Alphabet = alphabet;
+        params.m_Density = density;
+        params.m_Nondeterminism = 2;
+        params.m_FinalRatio = 0.05;
+        params.m_Seed = seed;
+        const NFA nfa1 = generateRandom(params);
+        params.m_Seed = seed + 1;
+        const NFA nfa2 = generateRandom(params);
+
+        benchCase(rows, "random" + to_string(states) + "-union", nfa1, nfa2, false);
+        benchCase(rows, "random" + to_string(states) + "-intersect", nfa1, nfa2, true);
+    }
+
+    for (const size_t n : {10, 14}) {
+        const NFA nfa1 = generateNthFromEnd(n);
+        const NFA nfa2 = generateNthFromEnd(n - 1);
+        benchCase(rows, "nthFromEnd" + to_string(n) + "-union", nfa1, nfa2, false);
+        benchCase(rows, "nthFromEnd" + to_string(n) + "-intersect", nfa1, nfa2, true);
+    }
+
+    benchPrint(rows, json);
+    return 0;
+}
+
+// --- Command line -----------------------------------------------------------
+
+/** Reads the whole file into the buffer, the buffer keeps its capacity between the calls */
+bool readFile(const string& path, string& buffer) {
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in) return false;
+
+    const streamsize size = in.tellg();
+    in.seekg(0);
+    buffer.resize(size);
+    return (bool) in.read(buffer.data(), size);
+}
+
+/** Reads and parses an operand, reports the failures to cerr */
+optional<NFA> readOperand(const string& path, string& buffer) {
+    if (!readFile(path, buffer)) {
+        cerr << path << ": cannot read" << endl;
+        return nullopt;
+    }
+
+    const char* error = nullptr;
+    optional<NFA> nfa = parseALT(buffer, &error);
+    if (!nfa)
+        cerr << path << ": invalid ALT automat at offset " << (error - buffer.data()) << endl;
+    return nfa;
+}
+
+/** Runs a single operation, writes into the file given or to cout if it is "-" */
+bool runOperation(const string& operation, const string& path1, const string& path2, const string& output,
+        string& buffer, const Options& options) {
+    if (operation != "unify" && operation != "intersect") {
+        cerr << operation << ": unknown operation" << endl;
+        return false;
+    }
+
+    const optional<NFA> nfa1 = readOperand(path1, buffer);
+    const optional<NFA> nfa2 = readOperand(path2, buffer);
+    if (!nfa1 || !nfa2) return false;
+
+    const DFA result = operation == "unify" ? unify(*nfa1, *nfa2, options) : intersect(*nfa1, *nfa2, options);
+    if (output == "-") {
+        writeALT(cout, result);
+        return true;
+    }
+
+    ofstream out(output);
+    writeALT(out, result);
+    if (!out) cerr << output << ": cannot write" << endl;
+    return (bool) out;
+}
+
+/**
+ * Each line of the manifest is "operation operand1 operand2 output",
+ * empty lines and the ones starting with # are skipped. The parse buffer
+ * and the operand cache are shared by all the lines. */
+bool runManifest(const string& path, const Options& options) {
+    ifstream manifest(path);
+    if (!manifest) {
+        cerr << path << ": cannot read" << endl;
+        return false;
+    }
+
+    OperandCache cache(64);
+    Options cached = options;
+    cached.m_Cache = &cache;
+
+    string buffer, line;
+    bool success = true;
+    for (size_t number = 1; getline(manifest, line); ++number) {
+        istringstream fields(line);
+        string operation, path1, path2, output;
+        if (!(fields >> operation) || operation[0] == '#') continue;
+
+        if (!(fields >> path1 >> path2 >> output)) {
+            cerr << path << ":" << number << ": expected operation operand1 operand2 output" << endl;
+            success = false;
+            continue;
+        }
+        success = runOperation(operation, path1, path2, output, buffer, cached) && success;
+    }
+    return success;
+}
+
+/**
+ * unify|intersect operand1.alt operand2.alt [output.alt]
+ * batch manifest.txt */
+int command(const int argc, char** argv) {
+    const string mode = argv[1];
+    string buffer;
+
+    if (mode == "batch" && argc == 3)
+        return runManifest(argv[2], {}) ? 0 : 1;
+    if ((mode == "unify" || mode == "intersect") && (argc == 4 || argc == 5))
+        return runOperation(mode, argv[2], argv[3], argc == 5 ? argv[4] : "-", buffer, {}) ? 0 : 1;
+
+    cerr << "usage: " << argv[0] << " unify|intersect operand1.alt operand2.alt [output.alt]\n"
+         << "       " << argv[0] << " batch manifest.txt\n"
+         << "       " << argv[0] << " " << benchUsage << endl;
+    return 2;
 }
 #endif